@@ -25,6 +25,7 @@ SOFTWARE.
 
 #include <View.h>
 #include "AlbumItem.h"
+#include "IconCache.h"
 
 
 #ifndef __HAIKU__
@@ -50,14 +51,22 @@ AlbumItem::AlbumItem(BRect frame, BBitmap *bitmap):
 	fPadding(6),
 	fTextHeight(10),
 	fBackColor(B_TRANSPARENT_COLOR),
-	fHighlightColor(ITEM_HIGHLIGHT_TEXT_COLOR)
+	fHighlightColor(ITEM_HIGHLIGHT_TEXT_COLOR),
+	fHighlight(0),
+	fPreviewWidth(0),
+	fPreviewHeight(0)
 {
+	for (int32 i = 0; i < ALBUMITEM_LEVELS - 1; i++)
+		fDetails[i] = NULL;
+	fDetailLevel = 0;
 }
 
 
 AlbumItem::~AlbumItem()
 {
-	delete fBitmap;
+	IconCache::Release(fBitmap);
+	for (int32 i = 0; i < ALBUMITEM_LEVELS - 1; i++)
+		delete fDetails[i];
 }
 
 
@@ -87,16 +96,33 @@ void AlbumItem::DrawItem(BView *owner)
 	// Icon
 	BPoint pos = BPoint(fFrame.left + fPadding, fFrame.top + fPadding);
 	if (fBitmap) {
+		// At the view's scale, the sharpest level needed, or the
+		// next best one there is.
+		float scale = owner->Scale();
+		int32 wanted = 0;
+		while (wanted < ALBUMITEM_LEVELS - 1 && (1 << wanted) < scale)
+			wanted++;
+		const BBitmap *bitmap = fBitmap;
+		for (int32 level = 1; level < ALBUMITEM_LEVELS; level++) {
+			if (fDetails[level - 1]) {
+				bitmap = fDetails[level - 1];
+				if (level >= wanted)
+					break;
+			}
+		}
 		owner->SetBlendingMode(B_PIXEL_ALPHA, B_ALPHA_OVERLAY);
+		// Details take the space of Bitmap().
+		BRect rect = fBitmap->Bounds().OffsetBySelf(pos);
 #ifdef __HAIKU__
 		// by hey68you@gmail.com
-		BRect rect = fBitmap->Bounds();
-		owner->DrawBitmap(fBitmap, rect, rect.OffsetBySelf(pos), B_FILTER_BITMAP_BILINEAR);
+		owner->DrawBitmap(bitmap, bitmap->Bounds(), rect, B_FILTER_BITMAP_BILINEAR);
 #else
-		owner->DrawBitmap(fBitmap, pos);
+		owner->DrawBitmap(bitmap, bitmap->Bounds(), rect);
 #endif		
 		pos.y += fBitmap->Bounds().Height();
 	}
+	else
+		pos.y += fPreviewHeight;
 	
 	// Labels
 	rgb_color fore = IsSelected() ? ITEM_SELECTED_TEXT_COLOR : ITEM_TEXT_COLOR;
@@ -130,6 +156,10 @@ void AlbumItem::Update(BView *owner)
 		fFrame.right += fBitmap->Bounds().Width();
 		fFrame.bottom += fBitmap->Bounds().Height();
 	}
+	else {
+		fFrame.right += fPreviewWidth;
+		fFrame.bottom += fPreviewHeight;
+	}
 	
 	if (owner) {
 		font_height fh;
@@ -188,13 +218,15 @@ uint32 AlbumItem::Flags()
 
 /**
 	Deletes the previously set bitmap and sets a new one.
-	\warning Takes over the ownership of 'bitmap'.
+	The details of the old one are deleted too.
+	\warning Takes over the ownership of 'bitmap', or the reference
+	if it is an IconCache icon, shared with other items.
 */
 void AlbumItem::SetBitmap(BBitmap *bitmap)
 {
-	if (fBitmap)
-		delete fBitmap;
+	IconCache::Release(fBitmap);
 	fBitmap = bitmap;
+	ClearDetails();
 }
 
 
@@ -204,6 +236,68 @@ const BBitmap* AlbumItem::Bitmap() const
 }
 
 
+/**
+	Sets a bigger version of Bitmap(), 2^level times its size.
+	It is drawn in place of Bitmap() when the view is zoomed in.
+	NULL deletes the level.
+	\warning Takes over the ownership of 'bitmap'.
+*/
+void AlbumItem::SetDetail(int32 level, BBitmap *bitmap)
+{
+	if (level < 1 || level >= ALBUMITEM_LEVELS) {
+		delete bitmap;
+		return;
+	}
+	delete fDetails[level - 1];
+	fDetails[level - 1] = bitmap;
+}
+
+
+const BBitmap* AlbumItem::Detail(int32 level) const
+{
+	if (level < 1 || level >= ALBUMITEM_LEVELS)
+		return NULL;
+	return fDetails[level - 1];
+}
+
+
+/**
+	Deletes all details, and forgets they were asked for.
+*/
+void AlbumItem::ClearDetails()
+{
+	for (int32 level = 1; level < ALBUMITEM_LEVELS; level++)
+		SetDetail(level, NULL);
+	fDetailLevel = 0;
+}
+
+
+/**
+	Notes the highest detail level asked for, so it is asked only once.
+	Reset by ClearDetails() and SetBitmap().
+*/
+void AlbumItem::SetDetailLevel(int32 level)
+{
+	fDetailLevel = level;
+}
+
+
+int32 AlbumItem::DetailLevel() const
+{
+	return fDetailLevel;
+}
+
+
+/**
+	Space reserved for a bitmap that has not arrived yet.
+*/
+void AlbumItem::SetPreviewSize(float width, float height)
+{
+	fPreviewWidth = width;
+	fPreviewHeight = height;
+}
+
+
 
 /**
 	Returns the number of label strings.
@@ -33,8 +33,14 @@ SOFTWARE.
 enum {
 	ALBUMITEM_HILIT 	= 0x01,	
 	ALBUMITEM_SEPARATOR = 0x02,	
+	// Bitmap() is a file icon, not a picture
+	ALBUMITEM_ICON = 0x04,
 };
 
+// Bitmap() and the detail levels, each twice the size of the one before.
+// ImageLoader makes the same thumbnail pyramid.
+#define ALBUMITEM_LEVELS 3
+
 class AlbumItem 
 {
 	public:
@@ -54,6 +60,12 @@ class AlbumItem
 	
 	void SetBitmap(BBitmap *bitmap);
 	const BBitmap* Bitmap() const;
+	void SetDetail(int32 level, BBitmap *bitmap);
+	const BBitmap* Detail(int32 level) const;
+	void ClearDetails();
+	void SetDetailLevel(int32 level);
+	int32 DetailLevel() const;
+	void SetPreviewSize(float width, float height);
 	
 	virtual uint16 CountLabels();
 	virtual void GetLabel(uint16 index, BString *label);
@@ -73,6 +85,10 @@ class AlbumItem
 	BRect fFrame;
 	uint32 fFlags;
 	BBitmap *fBitmap;
+	// levels 1 and up, for drawing zoomed in
+	BBitmap *fDetails[ALBUMITEM_LEVELS - 1];
+	// highest detail level asked for
+	int32 fDetailLevel;
 	bool fSelected;
 
 	protected:
@@ -81,6 +97,7 @@ class AlbumItem
 	float fTextHeight;
 	rgb_color fBackColor, fHighlightColor;
 	float fHighlight;
+	float fPreviewWidth, fPreviewHeight;
 };
 
 
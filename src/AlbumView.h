@@ -60,8 +60,8 @@ class AlbumView : public BufferedView, public BInvoker
 	AlbumItem* ItemAt(int32 index);
 	int32 IndexOf(AlbumItem *item);
 	int32 IndexOf(BPoint *point);
-	AlbumItem* AddItem(AlbumItem *item, int32 index = -1);
-	AlbumItem* RemoveItem(int32 index);
+	virtual AlbumItem* AddItem(AlbumItem *item, int32 index = -1);
+	virtual AlbumItem* RemoveItem(int32 index);
 	AlbumItem* EachItem(BObjectList<AlbumItem>::EachFunction func, void *param);
     void SetOrderBy(BObjectList<AlbumItem>::CompareFunction func);
 	BObjectList<AlbumItem>::CompareFunction OrderByFunc();
@@ -72,7 +72,7 @@ class AlbumView : public BufferedView, public BInvoker
 	int32 Select(int32 index, int32 count = 1, bool enabled = true);
 	int32 SelectBlock(int32 from, int32 to, bool enabled = true);
 	int32 CountSelected();
-	void DeleteSelected();
+	virtual void DeleteSelected();
 
 	void SetMask(uint32 mask);
 	const uint32 Mask();
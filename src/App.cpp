@@ -78,6 +78,7 @@ void App::ReadyToRun()
 	BMessage prefs;
 	// fail-safe defaults
 	prefs.AddInt32("load_options", 3);
+	prefs.AddInt32("load_workers", 0);
 	prefs.AddInt32("display_options", 1);
 	prefs.AddString("thumb_format","JPEG");
 	prefs.AddFloat("thumb_width",64);
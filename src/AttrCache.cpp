@@ -0,0 +1,123 @@
+/**
+\file AttrCache.cpp
+\brief On-demand attribute values
+
+ImageLoader reports only attribute names, types and sizes, plus the
+values of tiny attributes like "Marked", so loading a folder does not
+read thumbnails and other bulky attributes of every file. The sidebar
+gets the values of the selected files through an AttrCache, which
+reads each file once and keeps the values of the last ATTRCACHE_SIZE
+files around. MainWindow invalidates a file when its attributes change.
+*/
+
+#include <Node.h>
+#include <fs_attr.h>
+#include <string.h>
+#include "AttrCache.h"
+
+
+/// Cached values of one file
+struct attr_entry {
+	entry_ref ref;
+	BMessage values;
+};
+
+
+AttrCache::AttrCache(int32 capacity):
+	fEntries(capacity, true),
+	fCapacity(capacity)
+{
+}
+
+
+AttrCache::~AttrCache()
+{
+}
+
+
+/**
+	Returns the entry of 'ref', moved to the front.
+	A new one is made if needed, pushing out the oldest.
+*/
+attr_entry* AttrCache::EntryFor(const entry_ref &ref)
+{
+	attr_entry *entry;
+	for (int32 i = 0; (entry = fEntries.ItemAt(i)); i++) {
+		if (entry->ref == ref) {
+			if (i > 0) {
+				fEntries.RemoveItemAt(i);
+				fEntries.AddItem(entry, 0);
+			}
+			return entry;
+		}
+	}
+	if (fEntries.CountItems() >= fCapacity)
+		delete fEntries.RemoveItemAt(fEntries.CountItems() - 1);
+	entry = new attr_entry;
+	entry->ref = ref;
+	fEntries.AddItem(entry, 0);
+	return entry;
+}
+
+
+/**
+	Adds to 'values' every attribute listed in 'infos' that it lacks.
+	'infos' holds an attr_info per attribute name, as sent by
+	ImageLoader. Values not cached yet are read from the file.
+*/
+void AttrCache::GetValues(const entry_ref &ref, const BMessage *infos, BMessage *values)
+{
+	attr_entry *entry = EntryFor(ref);
+	BNode node;
+	char buf[ATTRCACHE_VALUE_SIZE];
+	char *name;
+	type_code type;
+	for (int32 i = 0; infos->GetInfo(B_ANY_TYPE, i, &name, &type) == B_OK; i++) {
+		if (values->HasData(name, B_ANY_TYPE))
+			continue;
+		const void *data;
+		ssize_t size;
+		if (entry->values.FindData(name, B_ANY_TYPE, &data, &size) != B_OK) {
+			const attr_info *info;
+			if (infos->FindData(name, B_RAW_TYPE, (const void**)&info, &size) != B_OK)
+				continue;
+			if (node.InitCheck() != B_OK && node.SetTo(&ref) != B_OK)
+				return;
+			ssize_t n = node.ReadAttr(name, info->type, 0, buf, sizeof(buf));
+			if (n < 0)
+				continue;
+			// AddData does not work for 0 sizes, fake something.
+			if (n == 0) {
+				n += 1;
+				buf[0] = 0;
+			}
+			entry->values.AddData(name, info->type, buf, n, false);
+			if (entry->values.FindData(name, B_ANY_TYPE, &data, &size) != B_OK)
+				continue;
+		}
+		type_code valueType;
+		entry->values.GetInfo(name, &valueType);
+		values->AddData(name, valueType, data, size, false);
+	}
+}
+
+
+/**
+	Forgets the values of 'ref'.
+*/
+void AttrCache::Invalidate(const entry_ref &ref)
+{
+	attr_entry *entry;
+	for (int32 i = 0; (entry = fEntries.ItemAt(i)); i++) {
+		if (entry->ref == ref) {
+			delete fEntries.RemoveItemAt(i);
+			return;
+		}
+	}
+}
+
+
+void AttrCache::MakeEmpty()
+{
+	fEntries.MakeEmpty();
+}
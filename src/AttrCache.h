@@ -0,0 +1,41 @@
+#ifndef _ATTRCACHE_H_
+#define _ATTRCACHE_H_
+
+#include <Entry.h>
+#include <Message.h>
+#include "ObjectList.h"
+
+// Number of files whose attribute values are kept
+#define ATTRCACHE_SIZE 64
+// Values are read up to this many bytes, plenty for display
+#define ATTRCACHE_VALUE_SIZE 256
+
+struct attr_entry;
+
+/**
+	Attribute values of recently displayed files.
+	Items carry only the names, types and sizes of their attributes,
+	the values are read here when something wants to show them.
+	Least recently used files are dropped first.
+	Not thread safe, meant for the window thread.
+*/
+class AttrCache
+{
+	public:
+
+	AttrCache(int32 capacity = ATTRCACHE_SIZE);
+	~AttrCache();
+	void GetValues(const entry_ref &ref, const BMessage *infos, BMessage *values);
+	void Invalidate(const entry_ref &ref);
+	void MakeEmpty();
+
+	private:
+
+	attr_entry* EntryFor(const entry_ref &ref);
+
+	// most recently used first
+	BObjectList<attr_entry> fEntries;
+	int32 fCapacity;
+};
+
+#endif
@@ -13,6 +13,7 @@
 #include "FileAttrDialog.h"
 #include "App.h"
 #include "ImageLoader.h"
+#include "ImageScaler.h"
 
 
 FileAttrDialog::FileAttrDialog(BRect frame, const char *title):
@@ -154,18 +155,47 @@ status_t FileAttrDialog::WriteThumbnailOp(entry_ref *ref, int32 index, BMessage
 	}
 					
 	if (bitmap) {
-    	BBitmapStream in(bitmap);
-    	BMallocIO out;
-    	status_t retcode = BTranslatorRoster::Default()->Translate(&in, NULL, NULL, &out, format,B_TRANSLATOR_BITMAP);
-    	if (retcode == B_OK) {
-    		node.WriteAttr(attrname, B_RAW_TYPE, 0, out.Buffer(), out.BufferLength());
-    	}
-    	in.DetachBitmap(&bitmap);
+		// stamped, so the loader knows when the file has moved on
+		time_t mtime = 0;
+		node.GetModificationTime(&mtime);
+		ImageLoader::WriteThumbnail(&node, attrname, bitmap, format, mtime);
 	}			
 	return B_OK;
 
 }
 
+/**
+	Scales 'bitmap' down to a B_CMAP8 icon of 'size' (B_LARGE_ICON == 32,
+	B_MINI_ICON == 16).
+*/
+BBitmap* FileAttrDialog::MakeIcon(BBitmap *bitmap, int32 size)
+{
+	BRect bounds(0, 0, size - 1, size - 1);
+	BBitmap *scaled = ImageScaler::Scale(bitmap, size, size);
+	if (scaled) {
+		BBitmap *icon = new BBitmap(bounds, B_CMAP8);
+#ifdef __HAIKU__
+		icon->ImportBits(scaled);
+#else
+		icon->SetBits(scaled->Bits(), scaled->BitsLength(), 0, scaled->ColorSpace());
+#endif
+		delete scaled;
+		return icon;
+	}
+
+	// Unusual color space, let the app_server do it.
+	BBitmap *icon = new BBitmap(bounds, B_CMAP8, true);
+	BView view(bounds, NULL, B_WILL_DRAW, 0);
+	icon->AddChild(&view);
+	icon->Lock();
+	view.DrawBitmap(bitmap, icon->Bounds());
+	view.Sync();
+	view.RemoveSelf();
+	icon->Unlock();
+	return icon;
+}
+
+
 /**
 	Processes one file.
 */
@@ -180,25 +210,10 @@ status_t FileAttrDialog::WriteTrackerIconOp(entry_ref *ref, int32 index, BMessag
 		return B_BAD_VALUE;
 
 	BNodeInfo nodeinfo(&node);
-    BView view(BRect(0, 0, 31,31), NULL, B_WILL_DRAW, 0);
-	
-	// B_LARGE_ICON == 32	
-	BBitmap *icon = new BBitmap(BRect(0, 0, B_LARGE_ICON - 1, B_LARGE_ICON - 1), B_CMAP8, true);
-	icon->AddChild(&view);
-	icon->Lock();
-	view.DrawBitmap(bitmap, icon->Bounds());
-	view.RemoveSelf();
-	icon->Unlock();
+	BBitmap *icon = MakeIcon(bitmap, B_LARGE_ICON);
 	nodeinfo.SetIcon(icon, B_LARGE_ICON);
 	delete icon;
-
-	// B_MINI_ICON == 16
-	icon = new BBitmap(BRect(0, 0, B_MINI_ICON - 1, B_MINI_ICON - 1), B_CMAP8, true);
-	icon->AddChild(&view);
-	icon->Lock();
-	view.DrawBitmap(bitmap, icon->Bounds());
-	view.RemoveSelf();
-	icon->Unlock();
+	icon = MakeIcon(bitmap, B_MINI_ICON);
 	nodeinfo.SetIcon(icon, B_MINI_ICON);
 	delete icon;
 
@@ -36,6 +36,7 @@ class FileAttrDialog : public BWindow
 	static status_t RemoveAttributesOp(entry_ref *ref, int32 i, BMessage *message);
 	static status_t MoveToTrashOp(entry_ref *ref, int32 i, BMessage *message);
 	static status_t RenameOp(entry_ref *ref, int32 i, BMessage *message);
+	static BBitmap* MakeIcon(BBitmap *bitmap, int32 size);
 	
 	BStatusBar *fProgress;
 };
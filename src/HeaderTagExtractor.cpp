@@ -0,0 +1,346 @@
+/**
+\file HeaderTagExtractor.cpp
+\brief Image size from file headers
+
+Most formats keep the image size at a fixed place near the file start,
+so a few dozen bytes tell it. The icons get their final shape and the
+items can be ordered by size long before a worker thread has decoded
+the pixels. The readers check what they read, since a magic of two
+bytes alone matches plenty of other files.
+*/
+
+#include <Debug.h>
+#include <stdlib.h>
+#include <string.h>
+#include <String.h>
+#include "HeaderTagExtractor.h"
+#include "JpegTagExtractor.h"
+#include "TiffTagExtractor.h"
+#include "IfdWalker.h"
+
+
+/// The registry, first match wins.
+const HeaderTagExtractor::format HeaderTagExtractor::kFormats[] = {
+	{ 0, 3, "\xff\xd8\xff", "image/jpeg", &HeaderTagExtractor::ReadJPEG },
+	{ 0, 4, "II*\0", "image/tiff", &HeaderTagExtractor::ReadTIFF },
+	{ 0, 4, "MM\0*", "image/tiff", &HeaderTagExtractor::ReadTIFF },
+	{ 0, 8, "\x89PNG\r\n\x1a\n", "image/png", &HeaderTagExtractor::ReadPNG },
+	{ 0, 6, "GIF87a", "image/gif", &HeaderTagExtractor::ReadGIF },
+	{ 0, 6, "GIF89a", "image/gif", &HeaderTagExtractor::ReadGIF },
+	{ 0, 2, "BM", "image/bmp", &HeaderTagExtractor::ReadBMP },
+	{ 8, 4, "WEBP", "image/webp", &HeaderTagExtractor::ReadWebP },
+	// no reader, for the type only
+	{ 0, 4, "8BPS", "image/vnd.adobe.photoshop", NULL },
+	{ 0, 12, "\0\0\0\x0cjP  \r\n\x87\n", "image/jp2", NULL },
+	{ 4, 8, "ftypavif", "image/avif", NULL },
+	{ 4, 8, "ftypheic", "image/heic", NULL }
+};
+
+
+/**
+	Converts ISO 8859-1 text to UTF-8.
+*/
+static void latin1_to_utf8(const uint8 *text, int32 length, BString *utf8)
+{
+	char *s = utf8->LockBuffer(2 * length + 1);
+	int32 n = 0;
+	for (int32 i = 0; i < length; i++) {
+		if (text[i] < 0x80)
+			s[n++] = text[i];
+		else {
+			s[n++] = 0xc0 | (text[i] >> 6);
+			s[n++] = 0x80 | (text[i] & 0x3f);
+		}
+	}
+	s[n] = 0;
+	utf8->UnlockBuffer(n);
+}
+
+
+HeaderTagExtractor::HeaderTagExtractor(BPositionIO *posio):
+	TagExtractor(posio),
+	fSource(posio)
+{
+}
+
+
+/**
+	Finds the table entry for the magic bytes in 'head'.
+*/
+const HeaderTagExtractor::format* HeaderTagExtractor::Sniff(const uint8 *head, ssize_t size)
+{
+	for (uint32 i = 0; i < sizeof(kFormats) / sizeof(kFormats[0]); i++) {
+		const format &f = kFormats[i];
+		if (f.offset + f.length <= size && memcmp(head + f.offset, f.magic, f.length) == 0)
+			return &f;
+	}
+	return NULL;
+}
+
+
+/**
+	Tells the MIME type by the content, NULL if unknown.
+	Only the file start is read.
+*/
+const char* HeaderTagExtractor::MimeType(BPositionIO *posio)
+{
+	uint8 head[HEADERTAGEXTRACTOR_HEAD_SIZE];
+	ssize_t size = posio->ReadAt(0, head, sizeof(head));
+	const format *f = size > 0 ? Sniff(head, size) : NULL;
+	return f ? f->type : NULL;
+}
+
+
+/**
+	Picks the reader by the magic bytes.
+	\returns B_BAD_VALUE if the format is unknown.
+*/
+status_t HeaderTagExtractor::Extract(BMessage *tags, uint32 *features)
+{
+	TagExtractor::Extract(tags);
+	if (features)
+		*features = 0;
+	uint8 head[HEADERTAGEXTRACTOR_HEAD_SIZE];
+	ssize_t size = fSource->ReadAt(0, head, sizeof(head));
+	const format *f = size > 0 ? Sniff(head, size) : NULL;
+	if (!f)
+		return B_BAD_VALUE;
+	// known, but nothing to read
+	if (!f->read)
+		return B_OK;
+	return (this->*f->read)(head, size);
+}
+
+
+/**
+	Adds the size pseudo tags, 'depth' only if known.
+*/
+void HeaderTagExtractor::SizeExtracted(int category, int32 width, int32 height, int16 depth)
+{
+	int16 w = width < 0x7fff ? width : 0x7fff;
+	int16 h = height < 0x7fff ? height : 0x7fff;
+	TagExtracted(category, 2, "Width", B_INT16_TYPE, &w, 2);
+	TagExtracted(category, 3, "Height", B_INT16_TYPE, &h, 2);
+	if (depth > 0)
+		TagExtracted(category, 4, "Depth", B_INT16_TYPE, &depth, 2);
+}
+
+
+/**
+	Only the SOF marker, the rest is up to JpegTagExtractor.
+*/
+status_t HeaderTagExtractor::ReadJPEG(const uint8 *head, ssize_t size)
+{
+	int16 width, height;
+	status_t status = JpegTagExtractor::ReadSize(fSource, &width, &height);
+	if (status == B_OK)
+		SizeExtracted('JPEG', width, height, 0);
+	return status;
+}
+
+
+/**
+	RAW files, the IFDs hold the size and the EXIF tags.
+*/
+status_t HeaderTagExtractor::ReadTIFF(const uint8 *head, ssize_t size)
+{
+	TiffTagExtractor tiff(fSource, 0, 0, false);
+	return tiff.Extract(fTags);
+}
+
+
+/**
+	IHDR comes first, text chunks may follow before the image data.
+*/
+status_t HeaderTagExtractor::ReadPNG(const uint8 *head, ssize_t size)
+{
+	if (size < 33 || memcmp(head + 12, "IHDR", 4) != 0)
+		return B_ERROR;
+	uint32 width = tiff_big_endian::Get32(head + 16);
+	uint32 height = tiff_big_endian::Get32(head + 20);
+	uint8 bits = head[24];
+	// samples per pixel by color type
+	static const int16 samples[7] = { 1, 0, 3, 1, 2, 0, 4 };
+	int16 depth = head[25] <= 6 ? bits * samples[head[25]] : 0;
+	if (width == 0 || height == 0)
+		return B_ERROR;
+	SizeExtracted('PNG ', width, height, depth);
+
+	// signature, IHDR and its CRC
+	off_t pos = 33;
+	for (int i = 0; i < HEADERTAGEXTRACTOR_MAX_BLOCKS; i++) {
+		uint8 chunk[8];
+		if (fSource->ReadAt(pos, chunk, 8) != 8)
+			break;
+		uint32 length = tiff_big_endian::Get32(chunk);
+		if (memcmp(chunk + 4, "IDAT", 4) == 0 || memcmp(chunk + 4, "IEND", 4) == 0)
+			break;
+		bool text = memcmp(chunk + 4, "tEXt", 4) == 0;
+		bool itext = memcmp(chunk + 4, "iTXt", 4) == 0;
+		if ((text || itext) && length <= HEADERTAGEXTRACTOR_MAX_TEXT) {
+			uint8 *data = (uint8*)malloc(length + 1);
+			if (data && fSource->ReadAt(pos + 8, data, length) == (ssize_t)length) {
+				data[length] = 0;
+				// keyword, NUL, then the text
+				int32 keyLength = strlen((char*)data);
+				const uint8 *value = data + keyLength + 1;
+				if (itext) {
+					// compression flag and method, language and
+					// translated keyword, compressed text is skipped
+					if (keyLength + 3 > (int32)length || value[0] != 0)
+						value = NULL;
+					else {
+						value += 2;
+						for (int n = 0; n < 2 && value; n++) {
+							const uint8 *end = (const uint8*)memchr(value, 0, data + length - value);
+							value = end ? end + 1 : NULL;
+						}
+					}
+				}
+				if (keyLength > 0 && keyLength < (int32)length && value) {
+					BString name("PNG:");
+					name.Append((char*)data, keyLength);
+					BString utf8;
+					if (text)
+						latin1_to_utf8(value, data + length - value, &utf8);
+					else
+						utf8.SetTo((const char*)value, data + length - value);
+					TagExtracted('PNG ', 0, name.String(), B_STRING_TYPE,
+						(void*)utf8.String(), utf8.Length() + 1);
+				}
+			}
+			free(data);
+		}
+		// length, type, data, CRC
+		pos += 12 + (off_t)length;
+	}
+	return B_OK;
+}
+
+
+/**
+	The logical screen is the image size. Comments before the first
+	image are read too.
+*/
+status_t HeaderTagExtractor::ReadGIF(const uint8 *head, ssize_t size)
+{
+	if (size < 13)
+		return B_ERROR;
+	uint16 width = tiff_little_endian::Get16(head + 6);
+	uint16 height = tiff_little_endian::Get16(head + 8);
+	uint8 packed = head[10];
+	bool globalColors = packed & 0x80;
+	// bits of the color table, or the color resolution without one
+	int16 depth = globalColors ? (packed & 7) + 1 : ((packed >> 4) & 7) + 1;
+	if (width == 0 || height == 0)
+		return B_ERROR;
+	SizeExtracted('GIF ', width, height, depth);
+
+	off_t pos = 13;
+	if (globalColors)
+		pos += 3 << ((packed & 7) + 1);
+	// Every block is a read, so there is a budget.
+	int reads = HEADERTAGEXTRACTOR_MAX_BLOCKS;
+	uint8 block[256];
+	BString comment;
+	while (reads-- > 0) {
+		// introducer and label
+		if (fSource->ReadAt(pos, block, 2) != 2 || block[0] != 0x21)
+			break;
+		bool isComment = block[1] == 0xfe;
+		pos += 2;
+		// data sub-blocks, up to an empty one
+		while (reads-- > 0) {
+			ssize_t n = fSource->ReadAt(pos, block, 256);
+			if (n < 1 || n < 1 + block[0])
+				break;
+			uint8 length = block[0];
+			pos += 1 + length;
+			if (length == 0)
+				break;
+			if (isComment)
+				comment.Append((char*)block + 1, length);
+		}
+	}
+	if (comment.Length() > 0) {
+		BString utf8;
+		latin1_to_utf8((const uint8*)comment.String(), comment.Length(), &utf8);
+		TagExtracted('GIF ', 0xfe, "Comment", B_STRING_TYPE, (void*)utf8.String(), utf8.Length() + 1);
+	}
+	return B_OK;
+}
+
+
+/**
+	OS/2 and Windows bitmap headers.
+*/
+status_t HeaderTagExtractor::ReadBMP(const uint8 *head, ssize_t size)
+{
+	if (size < 30)
+		return B_ERROR;
+	uint32 headerSize = tiff_little_endian::Get32(head + 14);
+	int32 width, height;
+	uint16 planes, bits;
+	if (headerSize == 12) {
+		width = tiff_little_endian::Get16(head + 18);
+		height = tiff_little_endian::Get16(head + 20);
+		planes = tiff_little_endian::Get16(head + 22);
+		bits = tiff_little_endian::Get16(head + 24);
+	}
+	else if (headerSize >= 16 && headerSize <= 124) {
+		width = (int32)tiff_little_endian::Get32(head + 18);
+		height = (int32)tiff_little_endian::Get32(head + 22);
+		planes = tiff_little_endian::Get16(head + 26);
+		bits = tiff_little_endian::Get16(head + 28);
+	}
+	else
+		return B_ERROR;
+	// top-down rows have a negative height
+	if (height < 0)
+		height = -height;
+	if (planes != 1 || width <= 0 || height <= 0 || bits == 0 || bits > 64)
+		return B_ERROR;
+	SizeExtracted('BMP ', width, height, bits);
+	return B_OK;
+}
+
+
+/**
+	The first chunk tells lossy, lossless or extended.
+*/
+status_t HeaderTagExtractor::ReadWebP(const uint8 *head, ssize_t size)
+{
+	if (size < 30 || memcmp(head, "RIFF", 4) != 0)
+		return B_ERROR;
+	const uint8 *chunk = head + 12;
+	const uint8 *data = head + 20;
+	uint32 width, height;
+	bool alpha;
+	if (memcmp(chunk, "VP8 ", 4) == 0) {
+		// frame tag, then the key frame start code
+		if (data[3] != 0x9d || data[4] != 0x01 || data[5] != 0x2a)
+			return B_ERROR;
+		width = tiff_little_endian::Get16(data + 6) & 0x3fff;
+		height = tiff_little_endian::Get16(data + 8) & 0x3fff;
+		alpha = false;
+	}
+	else if (memcmp(chunk, "VP8L", 4) == 0) {
+		if (data[0] != 0x2f)
+			return B_ERROR;
+		uint32 bits = tiff_little_endian::Get32(data + 1);
+		width = (bits & 0x3fff) + 1;
+		height = ((bits >> 14) & 0x3fff) + 1;
+		alpha = (bits >> 28) & 1;
+	}
+	else if (memcmp(chunk, "VP8X", 4) == 0) {
+		width = (tiff_little_endian::Get32(data + 4) & 0xffffff) + 1;
+		height = (tiff_little_endian::Get32(data + 6) >> 8) + 1;
+		alpha = data[0] & 0x10;
+	}
+	else
+		return B_ERROR;
+	if (width == 0 || height == 0)
+		return B_ERROR;
+	SizeExtracted('WEBP', width, height, alpha ? 32 : 24);
+	return B_OK;
+}
@@ -0,0 +1,55 @@
+#ifndef _HEADERTAGEXTRACTOR_H_
+#define _HEADERTAGEXTRACTOR_H_
+
+#include <TagExtractor.h>
+
+// Enough for every signature and fixed-size header.
+#define HEADERTAGEXTRACTOR_HEAD_SIZE 64
+// Longer text chunks are skipped.
+#define HEADERTAGEXTRACTOR_MAX_TEXT (16 * 1024)
+// Chunks and blocks looked at before giving up on metadata.
+#define HEADERTAGEXTRACTOR_MAX_BLOCKS 32
+
+/**
+	Reads the image size, bit depth and text metadata from file headers,
+	without decoding any pixels. The format is picked by its magic bytes
+	from a table of readers: JPEG, TIFF based RAW, PNG, GIF, BMP and WebP.
+	The same table tells the MIME type of files that have none.
+	Extracts "Width" and "Height" (B_INT16_TYPE), "Depth" in bits per
+	pixel (B_INT16_TYPE) where the header has it, and whatever text the
+	format keeps in front of the image data.
+*/
+class HeaderTagExtractor: public TagExtractor
+{
+    public:
+
+	HeaderTagExtractor(BPositionIO *posio);
+
+    virtual status_t Extract(BMessage *tags, uint32 *features = NULL);
+    static const char* MimeType(BPositionIO *posio);
+
+    private:
+
+    // An entry of the format table, 'read' can be NULL
+    struct format {
+        int32 offset;
+        int32 length;
+        const char *magic;
+        const char *type;
+        status_t (HeaderTagExtractor::*read)(const uint8 *head, ssize_t size);
+    };
+    static const format kFormats[];
+    static const format* Sniff(const uint8 *head, ssize_t size);
+
+    status_t ReadJPEG(const uint8 *head, ssize_t size);
+    status_t ReadTIFF(const uint8 *head, ssize_t size);
+    status_t ReadPNG(const uint8 *head, ssize_t size);
+    status_t ReadGIF(const uint8 *head, ssize_t size);
+    status_t ReadBMP(const uint8 *head, ssize_t size);
+    status_t ReadWebP(const uint8 *head, ssize_t size);
+    void SizeExtracted(int category, int32 width, int32 height, int16 depth);
+
+    BPositionIO *fSource;
+};
+
+#endif
@@ -0,0 +1,101 @@
+/**
+\file IconCache.cpp
+\brief Shared Tracker icons
+
+Files without a picture show their Tracker icon, and nearly all of them
+look just like every other file of their type. IconCache keeps a single
+bitmap per MIME type, counting the items that show it, and deletes it
+when the last one lets go. Only files with an icon of their own get a
+private bitmap, which Release() deletes like any other.
+*/
+
+#include <Autolock.h>
+#include <Locker.h>
+#include <NodeInfo.h>
+#include <String.h>
+#include <fs_attr.h>
+#include "ObjectList.h"
+#include "IconCache.h"
+
+
+/// One shared icon
+struct icon_entry {
+	BString type;
+	BBitmap *bitmap;
+	int32 refs;
+	~icon_entry() { delete bitmap; }
+};
+
+
+// A handful of types at most, searched one by one.
+static BObjectList<icon_entry> sIcons(16, true);
+static BLocker sIconsLock("icons");
+
+
+/**
+	Returns the 32x32 Tracker icon of 'node'.
+	The bitmap may be shared, give it back with Release().
+*/
+BBitmap* IconCache::Get(BNode *node)
+{
+	BNodeInfo info(node);
+	if (HasOwnIcon(node)) {
+		BBitmap *bitmap = new BBitmap(BRect(0,0,31,31), B_CMAP8);
+		info.GetTrackerIcon(bitmap);
+		return bitmap;
+	}
+	char type[B_MIME_TYPE_LENGTH];
+	if (info.GetType(type) != B_OK)
+		type[0] = 0;
+
+	BAutolock lock(sIconsLock);
+	icon_entry *entry;
+	for (int32 i = 0; (entry = sIcons.ItemAt(i)); i++) {
+		if (entry->type == type) {
+			entry->refs++;
+			return entry->bitmap;
+		}
+	}
+	// The first file of its type makes the icon for all.
+	entry = new icon_entry;
+	entry->type = type;
+	entry->bitmap = new BBitmap(BRect(0,0,31,31), B_CMAP8);
+	entry->refs = 1;
+	info.GetTrackerIcon(entry->bitmap);
+	sIcons.AddItem(entry);
+	return entry->bitmap;
+}
+
+
+/**
+	Drops a reference of a shared icon, deletes any other bitmap.
+*/
+void IconCache::Release(BBitmap *bitmap)
+{
+	if (bitmap == NULL)
+		return;
+	BAutolock lock(sIconsLock);
+	icon_entry *entry;
+	for (int32 i = 0; (entry = sIcons.ItemAt(i)); i++) {
+		if (entry->bitmap == bitmap) {
+			if (--entry->refs == 0)
+				delete sIcons.RemoveItemAt(i);
+			return;
+		}
+	}
+	delete bitmap;
+}
+
+
+/**
+	Files can carry an icon attribute of their own, overriding their type's.
+*/
+bool IconCache::HasOwnIcon(BNode *node)
+{
+	attr_info info;
+	return node->GetAttrInfo("BEOS:L:STD_ICON", &info) == B_OK
+#ifdef __HAIKU__
+		|| node->GetAttrInfo("BEOS:ICON", &info) == B_OK
+#endif
+		;
+}
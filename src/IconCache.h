@@ -0,0 +1,24 @@
+#ifndef _ICONCACHE_H_
+#define _ICONCACHE_H_
+
+#include <Bitmap.h>
+#include <Node.h>
+
+/**
+	Tracker icons shared by all files of the same MIME type.
+	Bitmaps from Get() go back with Release(), never delete.
+	Thread safe.
+*/
+class IconCache
+{
+	public:
+
+	static BBitmap* Get(BNode *node);
+	static void Release(BBitmap *bitmap);
+
+	private:
+
+	static bool HasOwnIcon(BNode *node);
+};
+
+#endif
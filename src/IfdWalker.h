@@ -0,0 +1,230 @@
+/**
+\file IfdWalker.h
+\brief Bounds-checked TIFF IFD parsing
+
+A TIFF block (the EXIF APP1 payload, or a whole TIFF based file) is
+walked in place, nothing is copied or byte-swapped in the source.
+The byte order is a template parameter, so reading a field compiles
+to a plain load, plus a swap where needed, without testing the order
+each time. Entries are only decoded when asked for, and every offset
+is checked against the size of the block first.
+*/
+
+#ifndef _IFDWALKER_H_
+#define _IFDWALKER_H_
+
+#include <SupportDefs.h>
+
+/// TIFF "MM" byte order
+struct tiff_big_endian {
+	static inline uint16 Get16(const uint8 *p)
+	{
+		return (uint16)((p[0] << 8) | p[1]);
+	}
+	static inline uint32 Get32(const uint8 *p)
+	{
+		return ((uint32)p[0] << 24) | ((uint32)p[1] << 16) | ((uint32)p[2] << 8) | p[3];
+	}
+};
+
+/// TIFF "II" byte order
+struct tiff_little_endian {
+	static inline uint16 Get16(const uint8 *p)
+	{
+		return (uint16)(p[0] | (p[1] << 8));
+	}
+	static inline uint32 Get32(const uint8 *p)
+	{
+		return p[0] | ((uint32)p[1] << 8) | ((uint32)p[2] << 16) | ((uint32)p[3] << 24);
+	}
+};
+
+
+/// Bytes per component of TIFF field type 'format', 0 if unknown
+inline uint32 tiff_format_bytes(uint16 format)
+{
+	// 13 is IFD, an offset like LONG
+	static const uint8 bytes[13] = { 1, 1, 2, 4, 8, 1, 1, 2, 4, 8, 4, 8, 4 };
+	return format >= 1 && format <= 13 ? bytes[format - 1] : 0;
+}
+
+
+/**
+	One 12-byte IFD entry.
+*/
+template <class Order>
+class IfdEntry
+{
+	public:
+
+	IfdEntry(const uint8 *tiff, uint32 size, const uint8 *entry):
+		fTiff(tiff),
+		fSize(size),
+		fEntry(entry)
+	{
+	}
+
+	inline uint16 Tag() const { return Order::Get16(fEntry); }
+	inline uint16 Format() const { return Order::Get16(fEntry + 2); }
+	inline uint32 Count() const { return Order::Get32(fEntry + 4); }
+
+	/// Size of the value in bytes, 0 for unknown formats.
+	uint32 ByteSize() const
+	{
+		uint32 bytes = tiff_format_bytes(Format());
+		if (bytes == 0)
+			return 0;
+		uint32 count = Count();
+		// overflow
+		if (count > 0xffffffffU / bytes)
+			return 0;
+		return count * bytes;
+	}
+
+	/// The raw value, in place or at its offset, NULL if out of bounds.
+	const uint8* Value() const
+	{
+		uint32 bytes = ByteSize();
+		if (bytes == 0)
+			return NULL;
+		if (bytes <= 4)
+			return fEntry + 8;
+		uint32 ofs = Order::Get32(fEntry + 8);
+		if (ofs > fSize || bytes > fSize - ofs)
+			return NULL;
+		return fTiff + ofs;
+	}
+
+	/// The value field as an offset into the TIFF block.
+	inline uint32 Offset() const { return Order::Get32(fEntry + 8); }
+
+	/**
+		Integer component 'index' of a BYTE, SHORT, LONG or IFD field.
+		Other formats give their first four bytes, first byte lowest.
+	*/
+	uint32 UInt(uint32 index = 0) const
+	{
+		const uint8 *value = Value();
+		if (!value || index >= Count())
+			return 0;
+		switch (Format()) {
+			case 3:		// SHORT
+			case 8:		// SSHORT
+				return Order::Get16(value + 2*index);
+			case 4:		// LONG
+			case 9:		// SLONG
+			case 13:	// IFD
+				return Order::Get32(value + 4*index);
+			case 1:		// BYTE
+			case 6:		// SBYTE
+				return value[index];
+			default:
+				return tiff_little_endian::Get32(fEntry + 8);
+		}
+	}
+
+	/**
+		RATIONAL or SRATIONAL component 'index'.
+	*/
+	bool Rational(uint32 index, int32 *numerator, int32 *denominator) const
+	{
+		uint16 format = Format();
+		if (format != 5 && format != 10)
+			return false;
+		const uint8 *value = Value();
+		if (!value || index >= Count())
+			return false;
+		*numerator = Order::Get32(value + 8*index);
+		*denominator = Order::Get32(value + 8*index + 4);
+		return true;
+	}
+
+	private:
+
+	const uint8 *fTiff;
+	uint32 fSize;
+	const uint8 *fEntry;
+};
+
+
+/**
+	Iterates the entries of one IFD.
+*/
+template <class Order>
+class IfdWalker
+{
+	public:
+
+	/**
+		'tiff' is the start of the TIFF header, 'ofs' that of the IFD.
+	*/
+	IfdWalker(const uint8 *tiff, uint32 size, uint32 ofs):
+		fTiff(tiff),
+		fSize(size),
+		fOffset(ofs),
+		fCount(0)
+	{
+		// The header takes 8 bytes, an empty IFD makes no sense.
+		if (ofs < 8 || ofs > size || size - ofs < 2)
+			return;
+		uint32 count = Order::Get16(tiff + ofs);
+		// entries and the next IFD offset must fit
+		if ((size - ofs - 2) / 12 < count || size - ofs - 2 - count * 12 < 4)
+			return;
+		fCount = count;
+	}
+
+	inline bool IsValid() const { return fCount > 0; }
+	inline int32 CountEntries() const { return fCount; }
+
+	inline IfdEntry<Order> EntryAt(int32 index) const
+	{
+		return IfdEntry<Order>(fTiff, fSize, fTiff + fOffset + 2 + 12*index);
+	}
+
+	/**
+		Offset of the following IFD, 0 if none.
+		Only forward links are followed, so a malformed chain
+		cannot loop.
+	*/
+	uint32 Next() const
+	{
+		if (!fCount)
+			return 0;
+		uint32 next = Order::Get32(fTiff + fOffset + 2 + 12*fCount);
+		return next > fOffset && next < fSize ? next : 0;
+	}
+
+	private:
+
+	const uint8 *fTiff;
+	uint32 fSize;
+	uint32 fOffset;
+	int32 fCount;
+};
+
+
+/**
+	Checks a TIFF header and returns the offset of IFD0, 0 if invalid.
+	'bigEndian' tells which walker to use.
+*/
+inline uint32 tiff_header(const uint8 *tiff, uint32 size, bool *bigEndian)
+{
+	if (size < 8)
+		return 0;
+	if (tiff[0] == 'M' && tiff[1] == 'M') {
+		*bigEndian = true;
+		if (tiff_big_endian::Get16(tiff + 2) != 42)
+			return 0;
+		return tiff_big_endian::Get32(tiff + 4);
+	}
+	if (tiff[0] == 'I' && tiff[1] == 'I') {
+		*bigEndian = false;
+		if (tiff_little_endian::Get16(tiff + 2) != 42)
+			return 0;
+		return tiff_little_endian::Get32(tiff + 4);
+	}
+	return 0;
+}
+
+#endif	// _IFDWALKER_H_
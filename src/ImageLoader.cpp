@@ -35,6 +35,13 @@ The BeOS API makes it really simple as the message protocols are
 essentially the same.  That way any client view can reflect 
 a criterion set by a query, adding and removing files automatically as 
 they come in and out of the scope of a query predicate.
+
+The looper enumerates files and keeps the node cache, announcing each
+new file right away with everything that needs no decoding. A pool of
+worker threads then reads the pixels, files on screen first, and reports
+back in MSG_LOADER_BATCH notices. Thumbnails come from a ThumbnailCache
+where they can, file changes settle before they are acted on, and Stop()
+drops everything still pending.
 */
 
 #define DEBUG 1
@@ -44,40 +51,122 @@ they come in and out of the scope of a query predicate.
 #include <Directory.h>
 #include <fs_attr.h>
 #include <NodeInfo.h>
+#include <MimeType.h>
 #include <Volume.h>
 #include <VolumeRoster.h>
 #include <NodeMonitor.h>
+#include <MessageQueue.h>
 #include <TranslationKit.h>
 #include <Bitmap.h>
 #include <View.h>
+#include <FindDirectory.h>
+#include <Path.h>
 #include "ImageLoader.h"
 #include "JpegTagExtractor.h"
+#include "TiffTagExtractor.h"
+#include "HeaderTagExtractor.h"
+#include "JpegDecoder.h"
+#include "ImageScaler.h"
+#include "IconCache.h"
+#include "AlbumItem.h"
 
 #define TRACKER_QUERY_STR_ATTR "_trk/qrystr"
 #define TRACKER_QUERY_VOL_ATTR "_trk/qryvol1"
 
+// MIME type -> the translator_id that last read it (int32)
+static BMessage sTranslators;
+static BLocker sTranslatorsLock("translators");
+
 /**
 	Creates a new node cache item.
 */
 file_item::file_item(node_ref &node):
-	nodref(node)	
+	nodref(node),
+	dirWatched(false),
+	size(-1),
+	mtime(0),
+	fingerprint(0)
+{
+}
+
+
+/**
+	Creates a new watched directory item.
+*/
+dir_item::dir_item(const node_ref &node):
+	nodref(node),
+	count(0),
+	addNew(false)
+{
+}
+
+
+/**
+	Creates a new pending change.
+*/
+node_change::node_change(const node_ref &node):
+	nodref(node),
+	mode(0),
+	first(0),
+	last(0)
+{
+}
+
+
+/**
+	Creates a new decoder job.
+	The prepared reply is copied.
+*/
+load_job::load_job(const entry_ref &entry, BMessage *message, uint32 flags):
+	ref(entry),
+	mode(flags),
+	priority(JOB_PRIORITY_NORMAL),
+	order(0),
+	generation(0),
+	cancelled(0),
+	fingerprint(0),
+	level(0)
 {
+	if (message)
+		reply = *message;
 }
 
 
 /// BObjectList compare function
-int node_cmp(const file_item *a, const file_item *b) 
+int noderef_cmp(const node_ref *a, const node_ref *b)
 {
-	if (a->nodref.device == b->nodref.device)
-		return a->nodref.node - b->nodref.node;
-	else
-		return a->nodref.device - b->nodref.device;
+	if (a->device != b->device)
+		return a->device < b->device ? -1 : 1;
+	if (a->node != b->node)
+		return a->node < b->node ? -1 : 1;
+	return 0;
+}
+
+/// BObjectList compare function
+int dir_cmp(const dir_item *a, const dir_item *b)
+{
+	return noderef_cmp(&a->nodref, &b->nodref);
 }
 
+
+
 /// BObjectList compare function
-file_item* ref_eq(file_item *item, void *param)
+int ref_cmp(const entry_ref *a, const entry_ref *b)
+{
+	if (a->device != b->device)
+		return a->device < b->device ? -1 : 1;
+	if (a->directory != b->directory)
+		return a->directory < b->directory ? -1 : 1;
+	return strcmp(a->name, b->name);
+}
+
+
+/// Job heap order: priority first, then first come first served.
+static inline bool job_before(const load_job *a, const load_job *b)
 {
-	return item->entref == *(entry_ref*)param ? item : NULL;
+	if (a->priority != b->priority)
+		return a->priority < b->priority;
+	return a->order < b->order;
 }
 
 
@@ -95,20 +184,56 @@ BQuery* live_query_tst(BQuery *item, void *param)
 */
 ImageLoader::ImageLoader(const char *name):
 	BLooper(name, B_NORMAL_PRIORITY),
-	fItems(32, true),
+	fItems(true, 256),
+	fRefs(false, 256),
+	fDirs(16, true),
+	fNodeWatches(32, true),
+	fViewWatches(32, true),
+	fSelectWatches(32, true),
+	fChanges(true, 64),
+	fSettleRunner(NULL),
 	fQueries(8, true),
 	fRunning(false),
+	fGeneration(0),
+	fLoadGeneration(0),
 	fLoadOptions(LOADER_READ_TAGS),
 	fThumbWidth(64),
 	fThumbHeight(64),
-	fReadAttr("IPRO:thumbnail")
+	fReadAttr("IPRO:thumbnail"),
+	fWriteAttr("IPRO:thumbnail"),
+	fWriteFormat(B_GIF_FORMAT),
+	fLiveQueries(false),
+	fJobs(256, true),
+	fActive(16, false),
+	fVisible(32, true),
+	fAhead(32, true),
+	fJobOrder(0),
+	fJobSem(-1),
+	fWorkerCount(0),
+	fBusy(0),
+	fBatch(MSG_LOADER_BATCH),
+	fBatchCount(0),
+	fBatchTime(0)
 {
+	BPath path;
+	if (find_directory(B_USER_SETTINGS_DIRECTORY, &path) == B_OK) {
+		BPath file(path.Path(), THUMBCACHE_FILE);
+		if (fCache.Open(file.Path()) != B_OK)
+			PRINT(("Thumbnail cache unavailable.\n"));
+		file.SetTo(path.Path(), THUMBCACHE_DETAIL_FILE);
+		if (fDetailCache.Open(file.Path(), THUMBCACHE_DETAIL_SIZE_LIMIT) != B_OK)
+			PRINT(("Detail cache unavailable.\n"));
+	}
+	// Not running yet, nothing else can queue jobs.
+	ResizeWorkers(0);
 }
 
 
 ImageLoader::~ImageLoader()
 {
     Stop();
+    StopWorkers();
+    delete fSettleRunner;
     stop_watching(this);
 	PRINT(("%s deleted.\n", Name()));
 }
@@ -116,27 +241,76 @@ ImageLoader::~ImageLoader()
 
 /**
 	Stops image processing ASAP.
+	Starts a new generation: queued jobs of the old one are dropped,
+	jobs already running give up at their next stage.
 	/warning Do not call from within ImageLooper handlers.
 */
 void ImageLoader::Stop()
 {
 	BAutolock lock(fStopLocker);
 	fRunning = false;
+	atomic_add(&fGeneration, 1);
 	fQueries.MakeEmpty();
+	BObjectList<file_item> placeholders(32, true);
+	BMessage deleted;
+	fQueueLock.Lock();
+	// Jobs in progress give up at their next stage...
+	load_job *job;
+	for (int32 i = 0; (job = fActive.ItemAt(i)); i++)
+		atomic_set(&job->cancelled, 1);
+	// ...and pending ones are dropped.
+	while ((job = fJobs.RemoveItemAt(fJobs.CountItems() - 1))) {
+		// Forget placeholders, so they get loaded if dropped again.
+		if (job->mode & JOB_PLACEHOLDER) {
+			placeholders.AddItem(new file_item(job->node));
+			deleted.AddRef("ref", &job->ref);
+		}
+		delete job;
+		atomic_add(&fBusy, -1);
+	}
+	fQueueLock.Unlock();
+	FlushUpdates();
+	if (!placeholders.IsEmpty()) {
+		RemoveCacheItems(&placeholders);
+		SendNotices(MSG_LOADER_DELETED, &deleted);
+	}
 	SendNotices(MSG_LOADER_DONE);
 	PRINT(("Stop.\n"));
 }
 
+/**
+	Tells whether the load being handled is still wanted.
+*/
 bool ImageLoader::IsRunning()
 {
 	BAutolock lock(fStopLocker);
-	return fRunning;
+	return fRunning && fLoadGeneration == atomic_get(&fGeneration);
+}
+
+
+/**
+	Returns the current load generation.
+	Clients add it to their B_SIMPLE_DATA messages as "generation",
+	so that drops still queued when Stop() is called are ignored.
+*/
+int32 ImageLoader::Generation()
+{
+	return atomic_get(&fGeneration);
 }
 
 
+/**
+	Sets the thumbnail attributes to look for, a space-separated list.
+	Generated thumbnails are written to the first one.
+*/
 void ImageLoader::SetAttrNames(const char *attrnames)
 {
 	fReadAttr = attrnames;
+	char name[B_ATTR_NAME_LENGTH];
+	if (sscanf(attrnames, " %255[^ ,]", name) == 1)
+		fWriteAttr = name;
+	else
+		fWriteAttr = "";
 }
 
 
@@ -154,10 +328,111 @@ void ImageLoader::SetThumbnailSize(float width, float height)
 }
 
 
+/**
+	Translator format of the thumbnails written with LOADER_WRITE_THUMBNAILS.
+*/
+void ImageLoader::SetThumbnailFormat(uint32 format)
+{
+	fWriteFormat = format;
+}
+
+
+/**
+	Sets the number of decoder threads.
+	0 means one per CPU.
+	Safe to call from any thread, the looper makes the change.
+*/
+void ImageLoader::SetWorkerCount(int32 count)
+{
+	BMessage message(CMD_LOADER_WORKERS);
+	message.AddInt32("count", count);
+	PostMessage(&message);
+}
+
+
+/**
+	Replaces the decoder threads with 'count' new ones, after those
+	at work have finished their jobs.
+	Only the looper queues jobs, so the job semaphore cannot be released
+	while it is replaced.
+*/
+void ImageLoader::ResizeWorkers(int32 count)
+{
+	if (count <= 0) {
+		system_info info;
+		get_system_info(&info);
+		count = info.cpu_count;
+	}
+	if (count != fWorkerCount) {
+		StopWorkers();
+		StartWorkers(count);
+	}
+}
+
+
+
+/**
+	Reorders pending jobs so that files in a client's viewport come first.
+	'message' holds "visible" and "ahead" refs, the latter for the items
+	about to be scrolled in, and "detail" refs that need thumbnail
+	pyramid level "level". Files in "watch" are watched closely.
+	Safe to call from any thread.
+*/
+void ImageLoader::SetViewport(BMessage *message)
+{
+	// Bigger thumbnails for zooming in, queued by the looper.
+	int32 level;
+	entry_ref detail;
+	if (message->FindInt32("level", &level) == B_OK && message->FindRef("detail", &detail) == B_OK) {
+		BMessage request(CMD_LOADER_DETAIL);
+		request.AddInt32("level", level);
+		for (int i = 0; message->FindRef("detail", i, &detail) == B_OK; i++)
+			request.AddRef("detail", &detail);
+		PostMessage(&request);
+	}
+
+	// Files to be watched closely
+	fStopLocker.Lock();
+	GetWatchNodes(message, &fViewWatches);
+	UpdateNodeWatches();
+	fStopLocker.Unlock();
+
+	entry_ref ref;
+	BAutolock lock(fQueueLock);
+	fVisible.MakeEmpty();
+	fAhead.MakeEmpty();
+	for (int i = 0; message->FindRef("visible", i, &ref) == B_OK; i++)
+		fVisible.AddItem(new entry_ref(ref));
+	for (int i = 0; message->FindRef("ahead", i, &ref) == B_OK; i++)
+		fAhead.AddItem(new entry_ref(ref));
+	fVisible.SortItems(ref_cmp);
+	fAhead.SortItems(ref_cmp);
+
+	// Re-rank everything and rebuild the heap bottom-up.
+	load_job *job;
+	for (int32 i = 0; (job = fJobs.ItemAt(i)); i++)
+		job->priority = JobPriority(job->ref);
+	for (int32 i = fJobs.CountItems()/2 - 1; i >= 0; i--)
+		SiftDown(i);
+}
+
+
+
+/**
+	Selected files are watched closely too, like those on screen.
+	'message' has their refs as "watch".
+*/
+void ImageLoader::SetSelection(BMessage *message)
+{
+	BAutolock lock(fStopLocker);
+	GetWatchNodes(message, &fSelectWatches);
+	UpdateNodeWatches();
+}
+
 
 void ImageLoader::MessageReceived(BMessage *message)
 {
-	
+	fLoadGeneration = Generation();
  	switch (message->what){
   		case B_SIMPLE_DATA:
   			RefsReceived(message);
@@ -166,12 +441,46 @@ void ImageLoader::MessageReceived(BMessage *message)
     	case B_QUERY_UPDATE:
 			NodeMonitorChange(message);
 	        break;
+		case CMD_LOADER_SETTLE:
+			SettleChanges();
+			break;
+		case CMD_LOADER_DETAIL:
+			DetailReceived(message);
+			break;
+		case CMD_LOADER_WORKERS: {
+			int32 count;
+			if (message->FindInt32("count", &count) == B_OK)
+				ResizeWorkers(count);
+			break;
+		}
  		case CMD_LOADER_DELETE:
 			DeleteReceived(message);
  			break;
    		default:
    			BLooper::MessageReceived(message);
-   			break;
+   			return;
+	}
+	// Nothing else to do right now, don't keep the clients waiting.
+	if (MessageQueue()->IsEmpty())
+		FlushUpdates();
+}
+
+
+/**
+	Queues the thumbnail pyramid level "level" of the "detail" refs.
+*/
+void ImageLoader::DetailReceived(BMessage *message)
+{
+	int32 level;
+	if (message->FindInt32("level", &level) != B_OK || level <= 0 || level >= ALBUMITEM_LEVELS)
+		return;
+	entry_ref ref;
+	for (int i = 0; message->FindRef("detail", i, &ref) == B_OK; i++) {
+		BMessage update;
+		update.AddRef("ref", &ref);
+		load_job *job = new load_job(ref, &update, JOB_READ_DATA | JOB_DATA_REQUIRED | JOB_UPDATE_ONLY);
+		job->level = level;
+		QueueJob(job);
 	}
 }
 
@@ -183,12 +492,18 @@ void ImageLoader::MessageReceived(BMessage *message)
 	sends back a message for each file.
 
 	After being processed, files are registered with the Node Monitor.
-	Note that there is an per-application limit of 4096 monitor slots (BeOS R5).
+	Note that there is an per-application limit of 4096 monitor slots (BeOS R5),
+	hence the switch to directory monitoring past IMAGELOADER_NODE_WATCH_LIMIT.
 */
 void ImageLoader::RefsReceived(BMessage *message)
 {
    	entry_ref ref;
 	type_code type;
+	int32 generation;
+	if (message->FindInt32("generation", &generation) == B_OK && generation != fLoadGeneration) {
+		PRINT(("Stale drop ignored.\n"));
+		return;
+	}
 	message->GetInfo("refs", &type, &fTotal);
 	fDone = 0;
    	fRunning = true;
@@ -197,14 +512,25 @@ void ImageLoader::RefsReceived(BMessage *message)
 	{
 		HandleRef(&ref);
 	}
-	fRunning = false;
 	
-	BQuery* first = fQueries.EachElement(live_query_tst,NULL);
-	if (first == NULL) 
-		SendNotices(MSG_LOADER_DONE);
-	else 
+	fLiveQueries = fQueries.EachElement(live_query_tst,NULL) != NULL;
+	fRunning = false;
+	// Otherwise the last worker will report.
+	if (atomic_get(&fBusy) == 0)
+		SendDone();
+}
+
+
+/**
+	Tells observers the loader has nothing more to do.
+*/
+void ImageLoader::SendDone()
+{
+	FlushUpdates();
+	if (fLiveQueries) 
 		SendNotices(MSG_LOADER_DONE_BUT_RUNNING);
-	
+	else 
+		SendNotices(MSG_LOADER_DONE);
 }
 
 
@@ -218,6 +544,30 @@ void ImageLoader::DeleteReceived(BMessage *message)
 	for (int i=0; message->FindRef("refs", i, &ref) == B_OK; i++) {
 		RemoveCacheItem(&ref);
 	}
+
+	// Don't bring back what has just been removed.
+	BObjectList<entry_ref> removed(32, true);
+	for (int i=0; message->FindRef("refs", i, &ref) == B_OK; i++)
+		removed.AddItem(new entry_ref(ref));
+	removed.SortItems(ref_cmp);
+	CancelJobs(&removed);
+
+	BAutolock lock(fQueueLock);
+	load_job *job;
+	int32 count = fJobs.CountItems();
+	for (int32 i = count - 1; (job = fJobs.ItemAt(i)); i--) {
+		if (removed.BinarySearch(job->ref, ref_cmp)) {
+			// Fill the gap with the last one, the heap is rebuilt below.
+			load_job *last = fJobs.RemoveItemAt(fJobs.CountItems() - 1);
+			if (last != job)
+				fJobs.SwapWithItem(i, last);
+			delete job;
+			atomic_add(&fBusy, -1);
+		}
+	}
+	if (fJobs.CountItems() != count)
+		for (int32 i = fJobs.CountItems()/2 - 1; i >= 0; i--)
+			SiftDown(i);
 }
 
 
@@ -248,8 +598,10 @@ void ImageLoader::NodeMonitorChange(BMessage *message)
 	message->FindInt32("device", &noderef.device); 
 	message->FindInt32("opcode", &opcode);    
 
-	// Look up cached items.
-	file_item *item = const_cast<file_item*>(fItems.BinarySearch(file_item(noderef), node_cmp));
+	// Look up cached items. Stop() and the workers remove them too,
+	// so the lock is held as long as 'item' is used.
+	BAutolock lock(fStopLocker);
+	file_item *item = fItems.Lookup(noderef);
 	
     if (item) {
 		BMessage reply(opcode);
@@ -264,9 +616,16 @@ void ImageLoader::NodeMonitorChange(BMessage *message)
 				message->FindString("name", &name);
 				message->FindInt64("from directory", &from);
 				message->FindInt64("to directory", &to);
+				if (item->dirWatched && item->entref.directory != to) {
+					// Follow it to the new folder.
+					UnwatchParent(node_ref(noderef.device, item->entref.directory));
+					WatchParent(node_ref(noderef.device, to));
+				}
+				fRefs.RemoveItem(item);
 				item->entref = entry_ref(noderef.device, to, name);
+				fRefs.Insert(item);
 				reply.AddRef("newref", &item->entref);
-				SendNotices(MSG_LOADER_UPDATE, &reply);
+				PostUpdate(&reply);
 				break;
 			}
 	       case B_STAT_CHANGED: {
@@ -276,50 +635,61 @@ void ImageLoader::NodeMonitorChange(BMessage *message)
 				// Haiku case when only attributes are changed, but this is superfluous to B_ATTR_CHANGED 
 				if (fields == B_STAT_CHANGE_TIME)
 					break;
-#endif		
+#endif
+				// Whether there is anything to decode is decided when it settles.
 	           	PRINT(("B_STAT_CHANGED: %s\n", item->entref.name));
-				if (ReadStats(&item->entref, &reply) == B_OK) {
-					ReadData(&item->entref, &reply);
-			   		SendNotices(MSG_LOADER_UPDATE, &reply);
-				}
+				QueueChange(noderef, JOB_READ_DATA);
 			   	break;
 		   }
 	       case B_ATTR_CHANGED: {
 	            PRINT(("B_ATTR_CHANGED: %s\n", item->entref.name));
-	            BNode node(&item->entref);
-			   	if (ReadAttributes(&node, &reply) == B_OK)
-			   		SendNotices(MSG_LOADER_UPDATE, &reply);
+				// Just the one that changed, if we are told which.
+				const char *attr = NULL;
+				message->FindString("attr", &attr);
+				QueueChange(noderef, JOB_READ_ATTRIBUTES, attr);
 	           	break;
 	       }
 	       case B_ENTRY_REMOVED: 
 	       		PRINT(("B_ENTRY_REMOVED: %s\n", item->entref.name));
-	       		if (RemoveCacheItem(&item->entref))
+	       		delete fChanges.Remove(noderef);
+	       		if (RemoveCacheItem(&item->entref)) {
+	       			FlushUpdates();
 					SendNotices(MSG_LOADER_DELETED, &reply);
+				}
 	           break;
 	    }
 	}	   
-   	// This one can come only from a live query.
+   	// From a live query, or a directory registered with WatchDirectory().
     else if (opcode == B_ENTRY_CREATED) {
-    	
+		// Not to be held while reading the stats.
+		lock.Unlock();
+
 		entry_ref ref;
         ref.device = noderef.device;
         const char *name = NULL;
         message->FindInt64("directory", &ref.directory);
+        if (message->what == B_NODE_MONITOR) {
+        	// Not just a folder watched for its files.
+        	BAutolock lock(fStopLocker);
+        	dir_item key(node_ref(ref.device, ref.directory));
+        	const dir_item *dir = fDirs.BinarySearch(key, dir_cmp);
+        	if (!dir || !dir->addNew)
+        		return;
+        }
         message->FindString("name", &name);
         ref.set_name(name);
         PRINT(("B_ENTRY_CREATED: %s\n", ref.name));
 
 		BMessage reply;
 		reply.AddRef("ref", &ref);		
-		if (ReadStats(&ref, &reply) != B_OK)
+		struct stat st;
+		if (ReadStats(&ref, &reply, &st) != B_OK)
 			return;
-		if (AddCacheItem(ref, noderef)) {
-			BNode node(&ref);
-			ReadAttributes(&node, &reply);
-			if (ReadData(&ref, &reply) == B_OK) {
-				SendNotices(MSG_LOADER_UPDATE, &reply);
-			}
-		}			
+		if (AddCacheItem(ref, noderef, &st)) {
+			load_job *job = new load_job(ref, &reply, JOB_READ_ATTRIBUTES | JOB_READ_DATA | JOB_DATA_REQUIRED);
+			job->node = noderef;
+			QueueJob(job);
+		}
 		
     }
 }
@@ -327,16 +697,135 @@ void ImageLoader::NodeMonitorChange(BMessage *message)
 
 
 /**
-	Caches a node and starts watching it.
+	Records a stat or attribute change to be processed once the file
+	has settled. Saving a file usually takes a series of writes, and
+	batch tools touch many files at once; whatever happens in between
+	is of no interest, so each file is re-read only once.
+	'attr' names the attribute that changed, NULL means any.
+*/
+void ImageLoader::QueueChange(const node_ref &node, uint32 mode, const char *attr)
+{
+	bigtime_t now = system_time();
+	node_change *change = fChanges.Lookup(node);
+	if (!change) {
+		change = new node_change(node);
+		change->first = now;
+		fChanges.Insert(change);
+	}
+	if (mode & JOB_READ_ATTRIBUTES) {
+		if (!attr)
+			change->mode |= JOB_READ_ATTRIBUTES;
+		else if (!(change->mode & JOB_READ_ATTRIBUTES)) {
+			bool known = false;
+			const char *name;
+			for (int32 i = 0; !known && change->attrs.FindString("attr", i, &name) == B_OK; i++)
+				known = strcmp(name, attr) == 0;
+			if (!known)
+				change->attrs.AddString("attr", attr);
+			change->mode |= JOB_READ_CHANGED_ATTRIBUTES;
+		}
+		mode &= ~JOB_READ_ATTRIBUTES;
+	}
+	change->mode |= mode;
+	change->last = now;
+	if (!fSettleRunner) {
+		BMessage settle(CMD_LOADER_SETTLE);
+		fSettleRunner = new BMessageRunner(BMessenger(this), &settle, IMAGELOADER_SETTLE_DELAY, 1);
+	}
+}
+
+
+/**
+	Queues jobs for the files whose changes have settled.
+*/
+void ImageLoader::SettleChanges()
+{
+	delete fSettleRunner;
+	fSettleRunner = NULL;
+
+	bigtime_t now = system_time();
+	BObjectList<node_change> settled(32, true);
+	for (int32 i = 0; i < fChanges.Capacity(); i++) {
+		node_change *change = fChanges.SlotAt(i);
+		if (change && (now - change->last >= IMAGELOADER_SETTLE_DELAY
+			|| now - change->first >= IMAGELOADER_SETTLE_MAX))
+			settled.AddItem(change);
+	}
+
+	node_change *change;
+	for (int32 i = 0; (change = settled.ItemAt(i)); i++) {
+		fChanges.RemoveItem(change);
+		BAutolock lock(fStopLocker);
+		file_item *item = fItems.Lookup(change->nodref);
+		if (!item)
+			continue;
+		uint32 mode = change->mode;
+		if (mode & JOB_READ_ATTRIBUTES)
+			mode &= ~JOB_READ_CHANGED_ATTRIBUTES;
+		BMessage reply(mode & JOB_READ_DATA ? B_STAT_CHANGED : B_ATTR_CHANGED);
+		reply.AddRef("ref", &item->entref);
+		load_job *job = new load_job(item->entref, NULL, 0);
+		if (mode & JOB_READ_DATA) {
+			struct stat st;
+			if (ReadStats(&item->entref, &reply, &st) != B_OK) {
+				delete job;
+				continue;
+			}
+			if (st.st_size == item->size && st.st_mtime == item->mtime)
+				// Permissions, owner and such, the image is the same.
+				mode &= ~JOB_READ_DATA;
+			else {
+				// Maybe only touched, the worker compares the content.
+				mode |= JOB_CHECK_CONTENT;
+				if (st.st_size == item->size)
+					job->fingerprint = item->fingerprint;
+			}
+			item->size = st.st_size;
+			item->mtime = st.st_mtime;
+		}
+		if (mode & JOB_READ_CHANGED_ATTRIBUTES)
+			job->attrs = change->attrs;
+		if (!(mode & (JOB_READ_DATA | JOB_READ_ATTRIBUTES | JOB_READ_CHANGED_ATTRIBUTES))) {
+			// New stats are all there is.
+			delete job;
+			reply.AddBool("update", true);
+			PostUpdate(&reply);
+			continue;
+		}
+		job->reply = reply;
+		job->mode = mode | JOB_UPDATE_ONLY;
+		job->node = change->nodref;
+		QueueJob(job);
+	}
+
+	// Still busy ones, check back later.
+	if (fChanges.CountItems() > 0) {
+		BMessage settle(CMD_LOADER_SETTLE);
+		fSettleRunner = new BMessageRunner(BMessenger(this), &settle, IMAGELOADER_SETTLE_DELAY, 1);
+	}
+}
+
+
+/**
+	Caches a node and starts watching it, or its directory.
 */
-bool ImageLoader::AddCacheItem(entry_ref &ref, node_ref &noderef)
+bool ImageLoader::AddCacheItem(entry_ref &ref, node_ref &noderef, const struct stat *st)
 {
 	// don't get interrupted by Stop() and stuff
 	BAutolock lock(fStopLocker);
 	file_item *item = new file_item(noderef);
-	if (fItems.BinaryInsertUnique(item, node_cmp)) {
-		item->entref = ref;
-		if (watch_node(&noderef, B_WATCH_ALL, this) == B_OK) 
+	item->entref = ref;
+	if (st) {
+		item->size = st->st_size;
+		item->mtime = st->st_mtime;
+	}
+	if (fItems.Insert(item)) {
+		fRefs.Insert(item);
+		if ((fLoadOptions & LOADER_WATCH_DIRECTORIES) || fItems.CountItems() > IMAGELOADER_NODE_WATCH_LIMIT) {
+			item->dirWatched = true;
+			WatchParent(node_ref(ref.device, ref.directory));
+		}
+		else if (watch_node(&noderef, B_WATCH_ALL, this) == B_OK) 
 			PRINT(("B_WATCH_ALL: %s\n", ref.name));
 		return true;
 	}
@@ -347,35 +836,186 @@ bool ImageLoader::AddCacheItem(entry_ref &ref, node_ref &noderef)
 	return false;
 }
 
+/**
+	Drops all cached nodes listed in 'nodes'.
+*/
+void ImageLoader::RemoveCacheItems(BObjectList<file_item> *nodes)
+{
+	BAutolock lock(fStopLocker);
+	file_item *node;
+	for (int32 i = 0; (node = nodes->ItemAt(i)); i++) {
+		file_item *item = fItems.Remove(node->nodref);
+		if (item) {
+			fRefs.RemoveItem(item);
+			UnwatchItem(item);
+			delete item;
+		}
+	}
+}
+
+
 bool ImageLoader::RemoveCacheItem(entry_ref *ref)
 {
 	// don't get interrupted by Stop() and stuff
 	BAutolock lock(fStopLocker);
-	file_item *item = fItems.EachElement(ref_eq, ref);
+	file_item *item = fRefs.Remove(*ref);
 	if (item) {
-		if (watch_node(&item->nodref, B_STOP_WATCHING, this) == B_OK) {
-			PRINT(("B_STOP_WATCHING: %s\n", item->entref.name));
-		}
-		fItems.RemoveItem(item, true);
+		PRINT(("B_STOP_WATCHING: %s\n", item->entref.name));
+		fItems.RemoveItem(item);
+		UnwatchItem(item);
+		delete item;
 		return true;			
 	}
 	return false;
 }
 
+
+/**
+	Stops all monitoring on behalf of a cached item.
+	\warning fStopLocker must be held.
+*/
+void ImageLoader::UnwatchItem(file_item *item)
+{
+	if (item->dirWatched) {
+		UnwatchParent(node_ref(item->entref.device, item->entref.directory));
+		const node_ref *node = fNodeWatches.BinarySearch(item->nodref, noderef_cmp);
+		if (!node)
+			return;
+		fNodeWatches.RemoveItem(const_cast<node_ref*>(node), true);
+	}
+	watch_node(&item->nodref, B_STOP_WATCHING, this);
+}
+
+
+/**
+	Counts a cached file in directory 'dir', watching it if needed.
+	\warning fStopLocker must be held.
+*/
+void ImageLoader::WatchParent(const node_ref &dir)
+{
+	dir_item key(dir);
+	dir_item *item = const_cast<dir_item*>(fDirs.BinarySearch(key, dir_cmp));
+	if (!item) {
+		item = new dir_item(dir);
+		fDirs.BinaryInsert(item, dir_cmp);
+		if (watch_node(&dir, B_WATCH_DIRECTORY, this) == B_OK)
+			PRINT(("B_WATCH_DIRECTORY: %Ld\n", dir.node));
+	}
+	item->count++;
+}
+
+
+/**
+	Counterpart of WatchParent().
+	\warning fStopLocker must be held.
+*/
+void ImageLoader::UnwatchParent(const node_ref &dir)
+{
+	dir_item key(dir);
+	dir_item *item = const_cast<dir_item*>(fDirs.BinarySearch(key, dir_cmp));
+	if (item && --item->count <= 0 && !item->addNew) {
+		watch_node(&dir, B_STOP_WATCHING, this);
+		fDirs.RemoveItem(item, true);
+	}
+}
+
+
+/**
+	Watches a directory and loads any file created in it.
+*/
+status_t ImageLoader::WatchDirectory(const node_ref &dir)
+{
+	BAutolock lock(fStopLocker);
+	dir_item key(dir);
+	dir_item *item = const_cast<dir_item*>(fDirs.BinarySearch(key, dir_cmp));
+	if (!item) {
+		status_t status = watch_node(&dir, B_WATCH_DIRECTORY, this);
+		if (status != B_OK)
+			return status;
+		item = new dir_item(dir);
+		fDirs.BinaryInsert(item, dir_cmp);
+	}
+	item->addNew = true;
+	return B_OK;
+}
+
+
+/**
+	Replaces 'nodes' with the nodes of the "watch" refs in 'message',
+	sorted. They come from the node cache, no file is touched.
+	Call with fStopLocker held.
+*/
+void ImageLoader::GetWatchNodes(BMessage *message, BObjectList<node_ref> *nodes)
+{
+	nodes->MakeEmpty();
+	entry_ref ref;
+	for (int32 i = 0; message->FindRef("watch", i, &ref) == B_OK; i++) {
+		const file_item *item = fRefs.Lookup(ref);
+		node_ref *node = item ? new node_ref(item->nodref) : NULL;
+		if (node && !nodes->BinaryInsertUnique(node, noderef_cmp))
+			delete node;
+	}
+}
+
+
+/**
+	Watches the files on screen and the selected ones.
+	Call with fStopLocker held.
+*/
+void ImageLoader::UpdateNodeWatches()
+{
+	BObjectList<node_ref> nodes(fViewWatches.CountItems() + fSelectWatches.CountItems(), true);
+	node_ref *node;
+	for (int32 i = 0; (node = fViewWatches.ItemAt(i)); i++)
+		nodes.AddItem(new node_ref(*node));
+	for (int32 i = 0; (node = fSelectWatches.ItemAt(i)); i++) {
+		if (!fViewWatches.BinarySearch(*node, noderef_cmp))
+			nodes.AddItem(new node_ref(*node));
+	}
+	nodes.SortItems(noderef_cmp);
+	SetNodeWatches(&nodes);
+}
+
+
+/**
+	Sets the files whose stats and attributes are watched
+	even though only their directory is. 'nodes' must be sorted.
+*/
+void ImageLoader::SetNodeWatches(BObjectList<node_ref> *nodes)
+{
+	BAutolock lock(fStopLocker);
+	// Keep only those that need it.
+	for (int32 i = nodes->CountItems() - 1; i >= 0; i--) {
+		const file_item *item = fItems.Lookup(*nodes->ItemAt(i));
+		if (!item || !item->dirWatched)
+			delete nodes->RemoveItemAt(i);
+	}
+	node_ref *node;
+	for (int32 i = 0; (node = fNodeWatches.ItemAt(i)); i++)
+		if (!nodes->BinarySearch(*node, noderef_cmp))
+			watch_node(node, B_STOP_WATCHING, this);
+	for (int32 i = 0; (node = nodes->ItemAt(i)); i++)
+		if (!fNodeWatches.BinarySearch(*node, noderef_cmp))
+			watch_node(node, B_WATCH_STAT | B_WATCH_ATTR, this);
+	fNodeWatches.MakeEmpty();
+	while ((node = nodes->RemoveItemAt(0)))
+		fNodeWatches.AddItem(node);
+}
+
 /**
 	Handles a generic entry_ref.
 */
 status_t ImageLoader::HandleRef(entry_ref *ref)
 {
-	if (fItems.CountItems() > IMAGELOADER_CACHE_LIMIT)
-		return B_ERROR;
-		
-	
+	// One stat tells both, and is kept for the file.
 	BEntry entry(ref, false);
-	if (entry.IsDirectory())
+	struct stat st;
+	if (entry.GetStat(&st) != B_OK)
+		return B_ERROR;
+	if (S_ISDIR(st.st_mode))
 	    return HandleDirectory(ref);
-	else if (entry.IsFile())
-		return HandleFile(ref);	 	
+	else if (S_ISREG(st.st_mode))
+		return HandleFile(ref, &st);	 	
 	else
 		return B_ERROR;  
 }
@@ -383,41 +1023,76 @@ status_t ImageLoader::HandleRef(entry_ref *ref)
 
 /**
 	Handles a real file.
+	Everything in phase one is read through a single open file.
+	A file with a cached thumbnail is not opened, it comes complete
+	from the cache but for its attributes, which a worker reads.
 */
-status_t ImageLoader::HandleFile(entry_ref *ref)
+status_t ImageLoader::HandleFile(entry_ref *ref, const struct stat *st)
 {		
-    BNode node;
-    if (node.SetTo(ref) != B_OK)
-    	return B_ERROR;
-
-    BString mime;
-	if (node.ReadAttr("BEOS:TYPE", B_MIME_STRING_TYPE, 0, mime.LockBuffer(B_MIME_TYPE_LENGTH), B_MIME_TYPE_LENGTH) == 0)
-		return B_BAD_VALUE;
-	mime.UnlockBuffer();
-	if (mime == "application/x-vnd.Be-query")
-		HandleTrackerQuery(&node);
-	else if ((fLoadOptions & LOADER_ONLY_IMAGES) && (mime.FindFirst("image/") != 0))
-		return B_OK;
-    else {
-		BMessage reply;
-		reply.AddRef("ref", ref);		
-		if (ReadStats(ref, &reply) != B_OK)
-			return B_ERROR;
-		node_ref noderef;
-		node.GetNodeRef(&noderef);			
-		bool newnode = AddCacheItem(*ref, noderef);
-		if (newnode || (fLoadOptions & LOADER_RELOAD_EXISTING)) {
-			BNode node(ref);
-			ReadAttributes(&node, &reply);
-			status_t ret = ReadData(ref, &reply);
-			if (ret != B_OK)
-				PRINT(("ReadData(): %s\n", strerror(ret)));
+	// Pictures in the thumbnail cache are known to be images,
+	// they are not even opened here.
+	thumb_key key;
+	ThumbKey(st, &key);
+	bool cached = fCache.Contains(key);
+
+    BFile node;
+    if (!cached) {
+	    if (node.SetTo(ref, B_READ_ONLY) != B_OK)
+	    	return B_ERROR;
+	    BString mime;
+		if (ReadType(&node, &mime) != B_OK)
+			return B_BAD_VALUE;
+		if (mime == "application/x-vnd.Be-query") {
+			HandleTrackerQuery(&node);
+			return B_OK;
 		}
+		if ((fLoadOptions & LOADER_ONLY_IMAGES) && (mime.FindFirst("image/") != 0))
+			return B_OK;
+	}
 
-		fDone++;
+	BMessage reply;
+	reply.AddRef("ref", ref);		
+	AddStats(st, &reply);
+	bool newnode = AddCacheItem(*ref, key.node, st);
+	if (newnode || (fLoadOptions & LOADER_RELOAD_EXISTING)) {
+		uint32 mode = JOB_PROGRESS | JOB_UPDATE_ONLY;
+		if (newnode)
+			mode |= JOB_PLACEHOLDER;
+		BMessage tags;
+		uint32 flags = 0;
+		uint32 fingerprint;
+		BBitmap *bitmap = cached ? fCache.Find(key, &tags, &flags, NULL, &fingerprint) : NULL;
+		if (bitmap) {
+			// All there, but for the attributes.
+			RecordFingerprint(key.node, fingerprint);
+			reply.AddPointer("bitmap", bitmap);
+			if (flags)
+				reply.AddInt32("flags", flags);	
+			if (!tags.IsEmpty())
+				reply.AddMessage("tags", &tags);
+			mode |= JOB_READ_ATTRIBUTES;
+		}
+		else if (node.InitCheck() == B_OK) {
+			// Phase one: everything that needs no decoding,
+			// so the file gets its place in the viewport.
+			ReadAttributes(&node, &reply);
+			ReadDimensions(&node, &reply);
+			mode |= JOB_READ_DATA;
+		}
+		else
+			mode |= JOB_READ_ATTRIBUTES | JOB_READ_DATA;
+		PostUpdate(&reply);
+		// Phase two, the pixels, is up to the workers.
+		BMessage update;
+		update.AddRef("ref", ref);
+		load_job *job = new load_job(*ref, &update, mode);
+		job->node = key.node;
+		QueueJob(job);
+	}
+	else {
 		reply.AddInt32("total", fTotal);
-		reply.AddInt32("done", fDone);
-		SendNotices(MSG_LOADER_UPDATE, &reply);
+		reply.AddInt32("done", atomic_add(&fDone, 1) + 1);
+		PostUpdate(&reply);
 	}
 	return B_OK;
 }
@@ -476,7 +1151,6 @@ status_t ImageLoader::HandleTrackerQuery(BNode *node)
 	
 	BVolume volume;
 	roster.Rewind();
-	fRunning = true;
 	while (IsRunning() && roster.GetNextVolume(&volume) == B_OK) {
 		if (!volume.IsPersistent() || !volume.KnowsQuery())
 			continue;
@@ -521,34 +1195,446 @@ status_t ImageLoader::HandleTrackerQuery(BNode *node)
 
 
 /**
-	Loads the actual image payload and decodes EXIF/IPTC.
+	Starts 'count' decoder threads.
+	Jobs already queued are picked up immediately.
 */
-status_t ImageLoader::ReadData(entry_ref *ref, BMessage *reply)
+void ImageLoader::StartWorkers(int32 count)
 {
-	BFile file(ref, B_READ_ONLY);
-	if (!file.IsReadable())
-		return B_ERROR;
-		
-	BMessage tags;		
-	BRect origbounds;
+	if (count > IMAGELOADER_MAX_WORKERS)
+		count = IMAGELOADER_MAX_WORKERS;
+	if (count < 1)
+		count = 1;
+	BAutolock lock(fQueueLock);
+	fJobSem = create_sem(fJobs.CountItems(), "ImageLoader jobs");
+	for (fWorkerCount = 0; fWorkerCount < count; fWorkerCount++) {
+		fWorkers[fWorkerCount] = spawn_thread(WorkerThread, "ImageLoader worker", B_LOW_PRIORITY, this);
+		resume_thread(fWorkers[fWorkerCount]);
+	}
+	PRINT(("%ld workers started.\n", fWorkerCount));
+}
 
-	// check file attributes for embedded thumbnails.
-	BBitmap *bitmap = NULL;
-	bitmap = ReadThumbnail(&file, fReadAttr.String());
 
-	uint32 flags = 0;
-	
-	if ((fLoadOptions & LOADER_READ_TAGS)) {
-		// Read JPEG tags but skip EXIF thumbnails if we've already got one.
-		bool readExifThumb = (fLoadOptions & LOADER_READ_EXIF_THUMB) && bitmap == NULL;
-		JpegTagExtractor extractor(&file, readExifThumb);
-		if (extractor.Extract(&tags, &flags) == B_OK) {
-			size_t size;
-			if (readExifThumb) {
-				void *data;
-				size = extractor.GetThumbnailData(&data, false);
-				if (size > 0) {
-					BMemoryIO memio(data, size);
+/**
+	Waits for all decoder threads to finish their current jobs and quit.
+	Pending jobs are kept.
+*/
+void ImageLoader::StopWorkers()
+{
+	// Blocked workers will wake up with an error.
+	delete_sem(fJobSem);
+	for (int i = 0; i < fWorkerCount; i++) {
+		status_t ret;
+		wait_for_thread(fWorkers[i], &ret);
+	}
+	fWorkerCount = 0;
+}
+
+
+int32 ImageLoader::WorkerThread(void *data)
+{
+	((ImageLoader*)data)->WorkerLoop();
+	return 0;
+}
+
+
+/**
+	Decoder thread body.
+	Runs until the semaphore is deleted.
+*/
+void ImageLoader::WorkerLoop()
+{
+	for (;;) {
+		// Don't sit on a partial batch while idle.
+		status_t status;
+		if (fBatchCount > 0) {
+			status = acquire_sem_etc(fJobSem, 1, B_RELATIVE_TIMEOUT, IMAGELOADER_BATCH_DELAY);
+			if (status == B_TIMED_OUT) {
+				FlushUpdates();
+				continue;
+			}
+		}
+		else
+			status = acquire_sem(fJobSem);
+		if (status != B_OK)
+			break;
+		fQueueLock.Lock();
+		load_job *job = PopJob();
+		if (job)
+			fActive.AddItem(job);
+		fQueueLock.Unlock();
+		// Could have been Stop()'d meanwhile.
+		if (job) {
+			ProcessJob(job);
+			fQueueLock.Lock();
+			fActive.RemoveItem(job);
+			fQueueLock.Unlock();
+			delete job;
+			if (atomic_add(&fBusy, -1) == 1 && !fRunning)
+				SendDone();
+		}
+	}
+}
+
+
+/**
+	Hands a job over to the decoder threads.
+	Only called by the looper, see ResizeWorkers().
+	\warning Takes over the ownership of 'job'.
+*/
+void ImageLoader::QueueJob(load_job *job)
+{
+	atomic_add(&fBusy, 1);
+	fQueueLock.Lock();
+	job->generation = fLoadGeneration;
+	job->order = fJobOrder++;
+	job->priority = JobPriority(job->ref);
+	PushJob(job);
+	fQueueLock.Unlock();
+	release_sem(fJobSem);
+}
+
+
+/**
+	Ranks a file against the last known viewport.
+	\warning fQueueLock must be held.
+*/
+int32 ImageLoader::JobPriority(const entry_ref &ref)
+{
+	if (fVisible.BinarySearch(ref, ref_cmp))
+		return JOB_PRIORITY_VISIBLE;
+	if (fAhead.BinarySearch(ref, ref_cmp))
+		return JOB_PRIORITY_AHEAD;
+	return JOB_PRIORITY_NORMAL;
+}
+
+
+/**
+	Inserts a job into the heap.
+	\warning fQueueLock must be held.
+*/
+void ImageLoader::PushJob(load_job *job)
+{
+	fJobs.AddItem(job);
+	int32 i = fJobs.CountItems() - 1;
+	while (i > 0) {
+		int32 parent = (i - 1)/2;
+		load_job *up = fJobs.ItemAt(parent);
+		if (!job_before(job, up))
+			break;
+		fJobs.SwapWithItem(i, up);
+		i = parent;
+	}
+	fJobs.SwapWithItem(i, job);
+}
+
+
+/**
+	Removes the most urgent job, NULL if there are none.
+	\warning fQueueLock must be held.
+*/
+load_job* ImageLoader::PopJob()
+{
+	int32 last = fJobs.CountItems() - 1;
+	if (last < 0)
+		return NULL;
+	load_job *top = fJobs.SwapWithItem(0, fJobs.ItemAt(last));
+	fJobs.RemoveItemAt(last);
+	SiftDown(0);
+	return top;
+}
+
+
+/**
+	Moves a job down the heap until both children are less urgent.
+	\warning fQueueLock must be held.
+*/
+void ImageLoader::SiftDown(int32 index)
+{
+	int32 count = fJobs.CountItems();
+	load_job *job = fJobs.ItemAt(index);
+	while (true) {
+		int32 child = 2*index + 1;
+		if (child >= count)
+			break;
+		if (child + 1 < count && job_before(fJobs.ItemAt(child + 1), fJobs.ItemAt(child)))
+			child++;
+		load_job *down = fJobs.ItemAt(child);
+		if (!job_before(down, job))
+			break;
+		fJobs.SwapWithItem(index, down);
+		index = child;
+	}
+	if (job)
+		fJobs.SwapWithItem(index, job);
+}
+
+
+/**
+	Reads the requested parts of a file and notifies the observers.
+	The job is checked for cancellation between the stages.
+	Runs in a decoder thread.
+*/
+void ImageLoader::ProcessJob(load_job *job)
+{
+	BMessage *reply = &job->reply;
+	if (IsCancelled(job)) {
+		DiscardJob(job);
+		return;
+	}
+	// All stages share one open file.
+	BFile file(&job->ref, B_READ_ONLY);
+	status_t status = file.InitCheck();
+	if (status != B_OK) {
+		FailJob(job, status);
+		return;
+	}
+	if (job->mode & (JOB_READ_ATTRIBUTES | JOB_READ_CHANGED_ATTRIBUTES)) {
+		if (job->mode & JOB_READ_ATTRIBUTES)
+			ReadAttributes(&file, reply);
+		else
+			ReadChangedAttributes(&file, &job->attrs, reply);
+		if (IsCancelled(job)) {
+			DiscardJob(job);
+			return;
+		}
+	}
+	if ((job->mode & JOB_READ_DATA) && !((job->mode & JOB_CHECK_CONTENT) && ContentUnchanged(job, &file))) {
+		status_t ret;
+		uint32 fingerprint = 0;
+		if (job->level > 0)
+			ret = ReadDetail(&file, reply, job->level, &job->cancelled);
+		else
+			ret = ReadData(&file, reply, &job->cancelled, &fingerprint);
+		if (!(job->mode & JOB_CHECK_CONTENT))
+			RecordFingerprint(job->node, fingerprint);
+		if (ret == B_CANCELED) {
+			DiscardJob(job);
+			return;
+		}
+		if (ret != B_OK) {
+			PRINT(("ReadData(): %s\n", strerror(ret)));
+			if (job->mode & JOB_DATA_REQUIRED) {
+				FailJob(job, ret);
+				return;
+			}
+		}
+	}
+	if (job->mode & JOB_UPDATE_ONLY)
+		reply->AddBool("update", true);
+	if (job->mode & JOB_PROGRESS) {
+		reply->AddInt32("total", fTotal);
+		reply->AddInt32("done", atomic_add(&fDone, 1) + 1);
+	}
+	// Checked under the batch lock, so nothing gets in
+	// after Stop() has flushed.
+	fBatchLock.Lock();
+	bool cancelled = IsCancelled(job);
+	if (!cancelled)
+		PostUpdate(reply);
+	fBatchLock.Unlock();
+	if (cancelled)
+		DiscardJob(job);
+}
+
+
+/**
+	Tells whether the result of 'job' is still wanted.
+*/
+bool ImageLoader::IsCancelled(load_job *job)
+{
+	return atomic_get(&job->cancelled) || job->generation != atomic_get(&fGeneration);
+}
+
+
+/**
+	Fingerprints the file of a JOB_CHECK_CONTENT job and remembers it.
+	Returns true if it matches the one the job was queued with.
+*/
+bool ImageLoader::ContentUnchanged(load_job *job, BFile *file)
+{
+	uint32 fingerprint = Fingerprint(file);
+	BAutolock lock(fStopLocker);
+	file_item *item = fItems.Lookup(job->node);
+	if (item)
+		item->fingerprint = fingerprint;
+	if (fingerprint && fingerprint == job->fingerprint) {
+		PRINT(("Content unchanged: %s\n", job->ref.name));
+		return true;
+	}
+	return false;
+}
+
+
+/**
+	Marks the jobs in progress for any of 'refs' as cancelled.
+	'refs' must be sorted.
+*/
+void ImageLoader::CancelJobs(BObjectList<entry_ref> *refs)
+{
+	BAutolock lock(fQueueLock);
+	load_job *job;
+	for (int32 i = 0; (job = fActive.ItemAt(i)); i++)
+		if (refs->BinarySearch(job->ref, ref_cmp))
+			atomic_set(&job->cancelled, 1);
+}
+
+
+/**
+	Cleans up after a cancelled job.
+	A placeholder is forgotten, as in Stop(), so the file gets loaded
+	if it is dropped again.
+*/
+void ImageLoader::DiscardJob(load_job *job)
+{
+	BBitmap *bitmap;
+	if (job->reply.FindPointer("bitmap", (void**)&bitmap) == B_OK)
+		IconCache::Release(bitmap);
+	PRINT(("Cancelled: %s\n", job->ref.name));
+	if ((job->mode & JOB_PLACEHOLDER) && RemoveCacheItem(&job->ref)) {
+		BMessage deleted;
+		deleted.AddRef("ref", &job->ref);
+		FlushUpdates();
+		SendNotices(MSG_LOADER_DELETED, &deleted);
+	}
+}
+
+
+/**
+	Winds up a job that got nothing to report.
+	A file that is gone is dropped like a removed one, and a counted
+	job still posts its progress, so the clients' totals add up.
+*/
+void ImageLoader::FailJob(load_job *job, status_t status)
+{
+	PRINT(("%s: %s\n", job->ref.name, strerror(status)));
+	if (status == B_ENTRY_NOT_FOUND && RemoveCacheItem(&job->ref)) {
+		BMessage deleted;
+		deleted.AddRef("ref", &job->ref);
+		FlushUpdates();
+		SendNotices(MSG_LOADER_DELETED, &deleted);
+	}
+	if (job->mode & JOB_PROGRESS) {
+		BMessage update;
+		update.AddRef("ref", &job->ref);
+		update.AddBool("update", true);
+		update.AddInt32("total", fTotal);
+		update.AddInt32("done", atomic_add(&fDone, 1) + 1);
+		BAutolock lock(fBatchLock);
+		if (!IsCancelled(job))
+			PostUpdate(&update);
+	}
+}
+
+
+/**
+	Adds a file update to the current batch.
+	Batches let clients apply many files with a single sort and layout pass.
+*/
+void ImageLoader::PostUpdate(BMessage *update)
+{
+	BAutolock lock(fBatchLock);
+	if (fBatchCount == 0)
+		fBatchTime = system_time();
+	fBatch.AddMessage("update", update);
+	if (++fBatchCount >= IMAGELOADER_BATCH_SIZE || system_time() - fBatchTime >= IMAGELOADER_BATCH_DELAY)
+		FlushUpdates();
+}
+
+
+/**
+	Sends out the pending updates.
+	Must precede any other notice that refers to the same files.
+*/
+void ImageLoader::FlushUpdates()
+{
+	BAutolock lock(fBatchLock);
+	if (fBatchCount > 0) {
+		SendNotices(MSG_LOADER_BATCH, &fBatch);
+		fBatch.MakeEmpty();
+		fBatchCount = 0;
+	}
+}
+
+
+
+/// Checks a load_job::cancelled flag.
+static inline bool is_cancelled(int32 *cancel)
+{
+	return cancel && atomic_get(cancel);
+}
+
+
+/**
+	Loads the actual image payload and decodes EXIF/IPTC.
+	'fingerprint' gets the content fingerprint of the file when it comes
+	for free, 0 otherwise.
+	Returns B_CANCELED as soon as '*cancel' gets set.
+	Runs in a decoder thread.
+*/
+status_t ImageLoader::ReadData(BFile *file, BMessage *reply, int32 *cancel, uint32 *fingerprint)
+{
+	if (!file->IsReadable())
+		return B_ERROR;
+		
+	BMessage tags;		
+	BRect origbounds;
+	uint32 flags = 0;
+
+	// Try the thumbnail cache first.
+	thumb_key key;
+	struct stat st;
+	bool cacheable = file->GetStat(&st) == B_OK;
+	if (cacheable) {
+		ThumbKey(&st, &key);
+		bool failed;
+		BBitmap *cached = fCache.Find(key, &tags, &flags, &failed, fingerprint);
+		if (failed) {
+			// Nothing decoded it last time, it is not going to now.
+			cached = ReadIcon(file);
+			reply->AddBool("icon", true);
+		}
+		if (cached) {
+			reply->AddPointer("bitmap", cached);
+			if (flags)
+				reply->AddInt32("flags", flags);	
+			if (!tags.IsEmpty())
+				reply->AddMessage("tags", &tags);
+			return B_OK;
+		}
+		tags.MakeEmpty();
+		flags = 0;
+	}
+	if (is_cancelled(cancel))
+		return B_CANCELED;
+
+	// Pyramid levels share the key scheme: one made at this size for
+	// zooming in, before the thumbnail size was changed, will do.
+	BBitmap *bitmap = NULL;
+	uint32 content = 0;
+	if (cacheable)
+		bitmap = fDetailCache.Find(key, NULL, NULL);
+	// check file attributes for embedded thumbnails.
+	if (!bitmap)
+		bitmap = ReadThumbnail(file, fReadAttr.String(), cacheable ? st.st_mtime : 0);
+	
+	if ((fLoadOptions & LOADER_READ_TAGS)) {
+		// Read JPEG tags but skip EXIF thumbnails if we've already got one.
+		bool readExifThumb = (fLoadOptions & LOADER_READ_EXIF_THUMB) && bitmap == NULL;
+		JpegTagExtractor extractor(file, readExifThumb);
+		status_t status = extractor.Extract(&tags, &flags);
+		if (status == B_BAD_VALUE && (bitmap || !TiffTagExtractor::IsTiff(file))) {
+			// Other formats by their headers. RAW files have EXIF tags
+			// too, without a thumbnail their preview reads them below.
+			HeaderTagExtractor header(file);
+			header.Extract(&tags, &flags);
+		}
+		else if (status == B_OK) {
+			size_t size;
+			if (readExifThumb) {
+				void *data;
+				size = extractor.GetThumbnailData(&data, false);
+				if (size > 0) {
+					BMemoryIO memio(data, size);
 					if (data && size > 0)
 						bitmap = BTranslationUtils::GetBitmap(&memio);
 				}
@@ -556,19 +1642,32 @@ status_t ImageLoader::ReadData(entry_ref *ref, BMessage *reply)
 		}
 	}
 
-	// No embedded thumbnails. Make one from the actual image data.
-	if (!bitmap) 
-		bitmap = ReadImagePreview(ref, fThumbWidth, fThumbHeight, &origbounds);
+	if (is_cancelled(cancel)) {
+		delete bitmap;
+		return B_CANCELED;
+	}
 
-   	// Still no picture. Load a Tracker-style icon.
-    if (!bitmap) {
-    	bitmap = new BBitmap(BRect(0,0,31,31), B_CMAP8);
-        BNodeInfo::GetTrackerIcon(ref, bitmap);
-   	}
-   	
-	// Make sure the recipient takes this bitmap's ownership!	
-    if (bitmap) 
-    	reply->AddPointer("bitmap", bitmap);
+	// No embedded thumbnails. Make one from the actual image data.
+	if (!bitmap) {
+		BMessage scratch;
+		bitmap = DecodeBitmap(file, fThumbWidth, fThumbHeight, &origbounds,
+			(fLoadOptions & LOADER_READ_TAGS) ? &tags : &scratch, &flags, cancel);
+		if (is_cancelled(cancel)) {
+			delete bitmap;
+			return B_CANCELED;
+		}
+		// The decoder has just read the file, the ends are in the
+		// file system cache.
+		if (bitmap)
+			content = Fingerprint(file);
+		// Keep it with the file, where the next visit finds it.
+		if (bitmap && cacheable && (fLoadOptions & LOADER_WRITE_THUMBNAILS)
+			&& fWriteAttr.Length() > 0) {
+			BVolume volume(st.st_dev);
+			if (volume.KnowsAttr() && !volume.IsReadOnly())
+				WriteThumbnail(file, fWriteAttr.String(), bitmap, fWriteFormat, st.st_mtime);
+		}
+	}
 
 	// Pseudo tags
 	int16 w;
@@ -577,6 +1676,22 @@ status_t ImageLoader::ReadData(entry_ref *ref, BMessage *reply)
 		tags.AddInt16("Height", origbounds.IntegerHeight()+1);
 	}
 
+	// Icons are not worth caching, only that there was no picture.
+	if (cacheable)
+		fCache.Store(key, bitmap, &tags, flags, content);
+	if (fingerprint)
+		*fingerprint = content;
+
+   	// Still no picture. Load a Tracker-style icon.
+    if (!bitmap) {
+    	bitmap = ReadIcon(file);
+    	reply->AddBool("icon", true);
+    }
+   	
+	// Make sure the recipient takes this bitmap's ownership!	
+    if (bitmap) 
+    	reply->AddPointer("bitmap", bitmap);
+
 	// JPEG features
 	if (flags)
 		reply->AddInt32("flags", flags);	
@@ -589,31 +1704,277 @@ status_t ImageLoader::ReadData(entry_ref *ref, BMessage *reply)
 
 
 
+/**
+	Fills in the thumbnail cache key of a file with stats 'st'.
+*/
+void ImageLoader::ThumbKey(const struct stat *st, thumb_key *key)
+{
+	key->node.device = st->st_dev;
+	key->node.node = st->st_ino;
+	key->size = st->st_size;
+	key->mtime = st->st_mtime;
+	key->width = fThumbWidth;
+	key->height = fThumbHeight;
+	key->options = fLoadOptions & (LOADER_READ_TAGS | LOADER_READ_EXIF_THUMB);
+}
+
+
+/**
+	Makes a thumbnail of 'width' x 'height' from the image data,
+	JPEG straight from the file we already have open.
+	RAW files add their tags to 'tags'. Returns NULL if nothing can
+	decode the file or '*cancel' got set.
+*/
+BBitmap* ImageLoader::DecodeBitmap(BFile *file, float width, float height, BRect *originalBounds,
+	BMessage *tags, uint32 *flags, int32 *cancel)
+{
+	JpegDecoder decoder(file);
+	decoder.SetCancelFlag(cancel);
+	BBitmap *original = decoder.Decode(width, height, originalBounds);
+	if (!original && !is_cancelled(cancel)) {
+		// Camera RAW files, their embedded JPEG is much faster.
+		original = ReadTiffPreview(file, width, height, originalBounds, tags, flags, cancel);
+	}
+	if (!original && !is_cancelled(cancel)) {
+		// Anything else goes through the TranslationKit.
+		BString type;
+		ReadType(file, &type);
+		original = TranslateBitmap(file, type.String());
+		if (original)
+			*originalBounds = original->Bounds();
+	}
+	if (!original || is_cancelled(cancel)) {
+		delete original;
+		return NULL;
+	}
+	BBitmap *bitmap = ScaleBitmap(original, width, height);
+	delete original;
+	return bitmap;
+}
+
+
+/**
+	Makes level 'level' of the thumbnail pyramid, 2^level times the
+	thumbnail size, for zooming in. Tags, embedded thumbnails and icons
+	are all up to ReadData(), only a bitmap is added to 'reply'.
+	Runs in a decoder thread.
+*/
+status_t ImageLoader::ReadDetail(BFile *file, BMessage *reply, int32 level, int32 *cancel)
+{
+	float width = fThumbWidth * (1 << level);
+	float height = fThumbHeight * (1 << level);
+	thumb_key key;
+	struct stat st;
+	bool cacheable = file->GetStat(&st) == B_OK;
+	BBitmap *bitmap = NULL;
+	if (cacheable) {
+		ThumbKey(&st, &key);
+		// Nothing decoded it for ReadData(), it is not going to now.
+		if (fCache.Failed(key))
+			return B_ERROR;
+		key.width = width;
+		key.height = height;
+		bitmap = fDetailCache.Find(key, NULL, NULL);
+		// or a thumbnail made at this size
+		if (!bitmap)
+			bitmap = fCache.Find(key, NULL, NULL);
+	}
+	if (!bitmap) {
+		BMessage tags;
+		uint32 flags;
+		BRect bounds;
+		bitmap = DecodeBitmap(file, width, height, &bounds, &tags, &flags, cancel);
+		if (is_cancelled(cancel)) {
+			delete bitmap;
+			return B_CANCELED;
+		}
+		// Failures are recorded once per file, by ReadData().
+		if (bitmap && cacheable)
+			fDetailCache.Store(key, bitmap, NULL, 0);
+	}
+	if (!bitmap)
+		return B_ERROR;
+	reply->AddPointer("bitmap", bitmap);
+	reply->AddInt32("level", level);
+	return B_OK;
+}
+
+
 /**
 	Reads statable properties into 'reply'.
 */
-status_t ImageLoader::ReadStats(entry_ref *ref, BMessage *reply)
+status_t ImageLoader::ReadStats(entry_ref *ref, BMessage *reply, struct stat *stats)
 {
 	BEntry entry(ref);
-	if (!entry.Exists())
-		return B_ENTRY_NOT_FOUND;
-
 	struct stat st;
-	if (entry.GetStat(&st) == B_OK) {
-		reply->AddInt64("fsize", st.st_size); 
-		reply->AddData("ctime", B_TIME_TYPE, &st.st_crtime, sizeof(time_t)); 
-		reply->AddData("mtime", B_TIME_TYPE, &st.st_mtime, sizeof(time_t)); 
-		return B_OK;
+	status_t status = entry.GetStat(&st);
+	if (status != B_OK)
+		return status;
+	AddStats(&st, reply);
+	if (stats)
+		*stats = st;
+	return B_OK;
+}
+
+
+
+/**
+	Adds the stats clients care about to 'reply'.
+*/
+void ImageLoader::AddStats(const struct stat *st, BMessage *reply)
+{
+	reply->AddInt64("fsize", st->st_size); 
+	reply->AddData("ctime", B_TIME_TYPE, &st->st_crtime, sizeof(time_t)); 
+	reply->AddData("mtime", B_TIME_TYPE, &st->st_mtime, sizeof(time_t)); 
+}
+
+
+
+/**
+	Remembers the content fingerprint of a file as it was first loaded,
+	so that a later touch of the file is told from a change.
+	It costs nothing extra: it comes with the cached thumbnail, or from a
+	file the decoder has just read. 0 is not recorded, files without one
+	are decoded again on every change.
+*/
+void ImageLoader::RecordFingerprint(const node_ref &node, uint32 fingerprint)
+{
+	if (fingerprint == 0)
+		return;
+	BAutolock lock(fStopLocker);
+	file_item *item = fItems.Lookup(node);
+	if (item)
+		item->fingerprint = fingerprint;
+}
+
+
+/**
+	Hashes the size and both ends of a file.
+	Headers and the end of the data are where edits show up, so this
+	tells a touched file from a modified one without reading it all.
+	Never returns 0.
+*/
+uint32 ImageLoader::Fingerprint(BFile *file)
+{
+	off_t size;
+	if (file->GetSize(&size) != B_OK)
+		return 0;
+	uint32 hash = hash_int64(size);
+	char buf[IMAGELOADER_FINGERPRINT_SIZE];
+	ssize_t n = file->ReadAt(0, buf, sizeof(buf));
+	if (n > 0)
+		hash = hash_data(buf, n, hash);
+	if (size > (off_t)(2 * sizeof(buf))) {
+		n = file->ReadAt(size - sizeof(buf), buf, sizeof(buf));
+		if (n > 0)
+			hash = hash_data(buf, n, hash);
 	}
-	return B_ERROR;
+	return hash ? hash : 1;
 }
 
 
 
+/**
+	Adds the image size to the "tags" of 'reply', if the file header has it.
+	Nothing is decoded, only headers are read. RAW files give their
+	EXIF tags as well.
+*/
+status_t ImageLoader::ReadDimensions(BFile *file, BMessage *reply)
+{
+	BMessage tags;
+	HeaderTagExtractor extractor(file);
+	status_t status = extractor.Extract(&tags);
+	int16 width;
+	if (status == B_OK && tags.FindInt16("Width", &width) == B_OK)
+		reply->AddMessage("tags", &tags);
+	return status;
+}
+
+
+
+/**
+	Gets the MIME type of 'file'. Files without a BEOS:TYPE attribute,
+	as on FAT and NTFS volumes, or with a generic one are typed by their
+	content.
+*/
+status_t ImageLoader::ReadType(BFile *file, BString *type)
+{
+	char buf[B_MIME_TYPE_LENGTH];
+	ssize_t n = file->ReadAttr("BEOS:TYPE", B_MIME_STRING_TYPE, 0, buf, sizeof(buf) - 1);
+	if (n > 0) {
+		buf[n] = 0;
+		type->SetTo(buf);
+		if (*type != B_FILE_MIME_TYPE)
+			return B_OK;
+	}
+	const char *sniffed = HeaderTagExtractor::MimeType(file);
+	if (sniffed)
+		type->SetTo(sniffed);
+	return sniffed || n > 0 ? B_OK : B_ENTRY_NOT_FOUND;
+}
+
+
+/**
+	Reads a bitmap with the TranslationKit.
+	Identifying a file asks every installed translator, so the one that
+	read a 'type' last time is tried on its own first.
+*/
+BBitmap* ImageLoader::TranslateBitmap(BPositionIO *file, const char *type)
+{
+	BTranslatorRoster *roster = BTranslatorRoster::Default();
+	if (!roster)
+		return NULL;
+	if (type && !*type)
+		type = NULL;
+	BBitmap *bitmap = NULL;
+	int32 id;
+	status_t status = B_ERROR;
+	if (type) {
+		BAutolock lock(sTranslatorsLock);
+		status = sTranslators.FindInt32(type, &id);
+	}
+	if (status == B_OK) {
+		BBitmapStream stream;
+		file->Seek(0, SEEK_SET);
+		if (roster->Translate(id, file, NULL, &stream, B_TRANSLATOR_BITMAP) == B_OK
+			&& stream.DetachBitmap(&bitmap) == B_OK)
+			return bitmap;
+	}
+
+	translator_info info;
+	file->Seek(0, SEEK_SET);
+	if (roster->Identify(file, NULL, &info, 0, type, B_TRANSLATOR_BITMAP) != B_OK)
+		return NULL;
+	BBitmapStream stream;
+	file->Seek(0, SEEK_SET);
+	if (roster->Translate(file, &info, NULL, &stream, B_TRANSLATOR_BITMAP) != B_OK
+		|| stream.DetachBitmap(&bitmap) != B_OK)
+		return NULL;
+	if (type) {
+		BAutolock lock(sTranslatorsLock);
+		if (sTranslators.ReplaceInt32(type, info.translator) != B_OK)
+			sTranslators.AddInt32(type, info.translator);
+	}
+	return bitmap;
+}
+
+
+/**
+	Gets a Tracker-style icon for files without a picture.
+	Most are shared by all files of a type, see IconCache.
+*/
+BBitmap* ImageLoader::ReadIcon(BNode *node)
+{
+	return IconCache::Get(node);
+}
+
+
 /**
 	Reads the first embedded BFS thumbnail.
+	If 'mtime' is given, thumbnails stamped with another modification
+	time are stale and skipped. Unstamped ones are always taken.
 */
-BBitmap* ImageLoader::ReadThumbnail(BNode *node, const char *attrnames)
+BBitmap* ImageLoader::ReadThumbnail(BNode *node, const char *attrnames, time_t mtime)
 {
 	BBitmap *bitmap = NULL;
     // Can be a list of up to 4 candidates.
@@ -624,6 +1985,14 @@ BBitmap* ImageLoader::ReadThumbnail(BNode *node, const char *attrnames)
     pch = strtok_r(atrlist, ", ", &prog);
     for (int i=0; pch && i < 4; i++) {
 	    attr_info attr;
+	    BString stampname(pch);
+	    stampname << IMAGELOADER_STAMP_SUFFIX;
+	    time_t stamp;
+	    if (mtime != 0 && node->ReadAttr(stampname.String(), B_TIME_TYPE, 0, &stamp, sizeof(stamp)) == sizeof(stamp)
+	    	&& stamp != mtime) {
+	    	pch = strtok_r(NULL, " ,", &prog);
+	    	continue;
+	    }
         if (node->GetAttrInfo(pch, &attr) == B_OK) {
 			// In-memory bitmap translation.
             char *buf = (char*)malloc(attr.size);
@@ -643,85 +2012,214 @@ BBitmap* ImageLoader::ReadThumbnail(BNode *node, const char *attrnames)
 
 
 /**
-	Read all attrs into a BMessage.
+	Writes 'bitmap' to the 'attrname' attribute of 'node' in the translator
+	'format', with 'mtime' of the source next to it, for ReadThumbnail()
+	to tell when it got stale. The bitmap stays with the caller.
+*/
+status_t ImageLoader::WriteThumbnail(BNode *node, const char *attrname, BBitmap *bitmap,
+	uint32 format, time_t mtime)
+{
+	BBitmapStream in(bitmap);
+	BMallocIO out;
+	status_t ret = BTranslatorRoster::Default()->Translate(&in, NULL, NULL, &out, format, B_TRANSLATOR_BITMAP);
+	in.DetachBitmap(&bitmap);
+	if (ret != B_OK)
+		return ret;
+	ssize_t n = node->WriteAttr(attrname, B_RAW_TYPE, 0, out.Buffer(), out.BufferLength());
+	if (n < 0)
+		return n;
+	BString stampname(attrname);
+	stampname << IMAGELOADER_STAMP_SUFFIX;
+	n = node->WriteAttr(stampname.String(), B_TIME_TYPE, 0, &mtime, sizeof(mtime));
+	return n < 0 ? n : B_OK;
+}
+
+
+/**
+	Lists all attrs of a node.
+	Their attr_info goes into "attr_info", and the values of the small
+	ones into "attributes".
 */
 status_t ImageLoader::ReadAttributes(BNode *node, BMessage *reply)
 {
-	BMessage msg;
+	BMessage msg, infos;
 	char attrname[B_ATTR_NAME_LENGTH];
-	// We'll be reading previews only.
-	char buf[256];
-    while (node->GetNextAttrName(attrname) == B_OK) {
-   		attr_info info;
-   		if (node->GetAttrInfo(attrname, &info) != B_OK)
-   			continue;
-   			
-		//TODO: waste less space for attrs which can't be displayed.
-		size_t size = sizeof(buf);
-		ssize_t n = node->ReadAttr(attrname, info.type, 0, buf, size);
-
-		// AddData does not work for 0 sizes, fake something.
-		if (n == 0) {
-			n += 1;
-			buf[0] = 0;
-		}
-		msg.AddData(attrname, info.type, buf, n, false);
-    }
+    while (node->GetNextAttrName(attrname) == B_OK)
+    	ReadAttribute(node, attrname, &msg, &infos);
     if (!msg.IsEmpty())
     	reply->AddMessage("attributes", &msg);		
+    if (!infos.IsEmpty())
+    	reply->AddMessage("attr_info", &infos);		
     return B_OK;
 }
 
 
+/**
+	Reads only the attributes listed as "attr" in 'names'.
+	They go into "changed_attributes" and "changed_attr_info", and
+	the names of those that no longer exist into "removed_attributes".
+*/
+status_t ImageLoader::ReadChangedAttributes(BNode *node, BMessage *names, BMessage *reply)
+{
+	BMessage msg, infos;
+	const char *attrname;
+	for (int32 i = 0; names->FindString("attr", i, &attrname) == B_OK; i++) {
+		if (ReadAttribute(node, attrname, &msg, &infos) == B_ENTRY_NOT_FOUND)
+			reply->AddString("removed_attributes", attrname);
+	}
+    if (!msg.IsEmpty())
+    	reply->AddMessage("changed_attributes", &msg);		
+    if (!infos.IsEmpty())
+    	reply->AddMessage("changed_attr_info", &infos);		
+    return B_OK;
+}
+
+
+/**
+	Adds the attr_info of attribute 'name' to 'infos' and, if it is
+	no bigger than IMAGELOADER_ATTR_INLINE_SIZE, its value to 'attributes'.
+	Bigger values are left for an AttrCache to read when needed.
+*/
+status_t ImageLoader::ReadAttribute(BNode *node, const char *name, BMessage *attributes, BMessage *infos)
+{
+	attr_info info;
+	status_t status = node->GetAttrInfo(name, &info);
+	if (status != B_OK)
+		return status;
+	infos->AddData(name, B_RAW_TYPE, &info, sizeof(info), false);
+	if (info.size > IMAGELOADER_ATTR_INLINE_SIZE)
+		return B_OK;
+
+	char buf[IMAGELOADER_ATTR_INLINE_SIZE];
+	ssize_t n = node->ReadAttr(name, info.type, 0, buf, sizeof(buf));
+	if (n < 0)
+		return n;
+
+	// AddData does not work for 0 sizes, fake something.
+	if (n == 0) {
+		n += 1;
+		buf[0] = 0;
+	}
+	return attributes->AddData(name, info.type, buf, n, false);
+}
+
+
 
 
 /** 
-	Loads an image with the TranslationKit and scales it.
-	Ratios are respected.
+	Loads an image and scales it.
+	JPEG files are decoded at reduced size, anything else goes through
+	the TranslationKit. Ratios are respected.
 */
 BBitmap* ImageLoader::ReadImagePreview(entry_ref *ref, float width, float height, BRect *originalBounds)
 {	
-    BBitmap *original = BTranslationUtils::GetBitmap(ref);
-    if (original) {
-    	float w0 = original->Bounds().Width();
-    	float h0 = original->Bounds().Height();
-		// ratios
-    	float rx = width/w0;
-    	float ry = height/h0;
-    	// fit to frame
-    	if (h0*rx > height)
-			width = ceil(w0*ry);
-		else if (w0*ry > width)
-			height = ceil(h0*rx);
-
-		PRINT(("Creating %.0fx%.0f thumbnail for '%s'.\n", width, height, ref->name ));
-			
-		// save original bounds
-		BRect frame(0, 0, width, height);
-		if (originalBounds)
+	BFile file(ref, B_READ_ONLY);
+	if (file.InitCheck() != B_OK)
+		return NULL;
+	PRINT(("Creating thumbnail for '%s'.\n", ref->name));
+	return ReadImagePreview(&file, width, height, originalBounds);
+}
+
+
+/**
+	Same as above, from an open file.
+*/
+BBitmap* ImageLoader::ReadImagePreview(BPositionIO *file, float width, float height, BRect *originalBounds)
+{	
+	JpegDecoder decoder(file);
+	BBitmap *original = decoder.Decode(width, height, originalBounds);
+	if (!original) {
+		BMessage tags;
+		uint32 flags;
+		original = ReadTiffPreview(file, width, height, originalBounds, &tags, &flags);
+	}
+	if (!original) {
+		original = TranslateBitmap(file, HeaderTagExtractor::MimeType(file));
+		if (original && originalBounds)
 			*originalBounds = original->Bounds();
-			
-		// scale the original using an off-screen BView
-		BBitmap* bitmap = new BBitmap(frame, original->ColorSpace(), true);
-		BView* view = new BView(frame, NULL, B_FOLLOW_ALL, B_WILL_DRAW);
-		bitmap->Lock();
-		bitmap->AddChild(view);
+	}
+	if (original) {
+		BBitmap *bitmap = ScaleBitmap(original, width, height);
+		delete original;
+		return bitmap;
+	}
+	return NULL;
+}
+
+
+/**
+	Decodes the JPEG preview embedded in a TIFF based RAW file, at the
+	smallest size that still covers 'width' x 'height'. The tags of the
+	file go to 'tags'. Returns NULL if there is no usable preview.
+*/
+BBitmap* ImageLoader::ReadTiffPreview(BPositionIO *file, float width, float height, BRect *originalBounds,
+	BMessage *tags, uint32 *flags, int32 *cancel)
+{
+	if (!TiffTagExtractor::IsTiff(file))
+		return NULL;
+	TiffTagExtractor extractor(file, width, height);
+	if (extractor.Extract(tags, flags) != B_OK)
+		return NULL;
+	void *data;
+	size_t size = extractor.GetThumbnailData(&data, false);
+	if (!size)
+		return NULL;
+	BMemoryIO memio(data, size);
+	JpegDecoder decoder(&memio);
+	decoder.SetCancelFlag(cancel);
+	BRect previewBounds;
+	BBitmap *bitmap = decoder.Decode(width, height, &previewBounds);
+	if (bitmap && originalBounds) {
+		// the RAW size, if the tags have it
+		int16 w, h;
+		if (tags->FindInt16("Width", &w) == B_OK && tags->FindInt16("Height", &h) == B_OK)
+			originalBounds->Set(0, 0, w - 1, h - 1);
+		else
+			*originalBounds = previewBounds;
+	}
+	return bitmap;
+}
+
+
+/**
+	Makes a copy of 'original' that fits into 'width' x 'height'.
+*/
+BBitmap* ImageLoader::ScaleBitmap(BBitmap *original, float width, float height)
+{
+	float w0 = original->Bounds().Width();
+	float h0 = original->Bounds().Height();
+	// ratios
+	float rx = width/w0;
+	float ry = height/h0;
+	// fit to frame
+	if (h0*rx > height)
+		width = ceil(w0*ry);
+	else if (w0*ry > width)
+		height = ceil(h0*rx);
+
+	BRect frame(0, 0, width, height);
+	BBitmap *bitmap = ImageScaler::Scale(original, frame.IntegerWidth() + 1, frame.IntegerHeight() + 1);
+	if (bitmap)
+		return bitmap;
+
+	// unusual color space, scale the original using an off-screen BView
+	bitmap = new BBitmap(frame, original->ColorSpace(), true);
+	BView* view = new BView(frame, NULL, B_FOLLOW_ALL, B_WILL_DRAW);
+	bitmap->Lock();
+	bitmap->AddChild(view);
 #ifdef __HAIKU__
-		// by hey68you@gmail.com
-		view->SetDrawingMode( B_OP_ALPHA );
-		view->SetBlendingMode(B_PIXEL_ALPHA, B_ALPHA_COMPOSITE);
-		view->DrawBitmap(original, original->Bounds(), frame, B_FILTER_BITMAP_BILINEAR);
+	// by hey68you@gmail.com
+	view->SetDrawingMode( B_OP_ALPHA );
+	view->SetBlendingMode(B_PIXEL_ALPHA, B_ALPHA_COMPOSITE);
+	view->DrawBitmap(original, original->Bounds(), frame, B_FILTER_BITMAP_BILINEAR);
 #else
-		view->SetViewColor(ui_color(B_PANEL_BACKGROUND_COLOR));
-		view->DrawBitmap(original, frame);
+	view->SetViewColor(ui_color(B_PANEL_BACKGROUND_COLOR));
+	view->DrawBitmap(original, frame);
 #endif
-		view->RemoveSelf();
-		bitmap->Unlock();
-		delete view;
-    	delete original;
-    	return bitmap;
-    }
-	return NULL;
+	view->RemoveSelf();
+	bitmap->Unlock();
+	delete view;
+	return bitmap;
 }
 
 
@@ -23,23 +23,48 @@ SOFTWARE.
 #define IMAGELOADER_H_
 
 #include <Looper.h>
+#include <OS.h>
 #include <Entry.h>
 #include <Node.h>
 #include <Locker.h>
 #include <String.h>
+#include <MessageRunner.h>
 
 #include <Query.h>
 #include "ObjectList.h"
+#include "HashTable.h"
+#include "ThumbnailCache.h"
 
-#define IMAGELOADER_CACHE_LIMIT 4096
+// Beyond this many files only their folders are watched.
+#define IMAGELOADER_NODE_WATCH_LIMIT 2048
+#define IMAGELOADER_MAX_WORKERS 16
+// Updates are sent in batches of up to this many...
+#define IMAGELOADER_BATCH_SIZE 64
+// ...or after this many microseconds.
+#define IMAGELOADER_BATCH_DELAY 50000
+// Node monitor changes are acted on once a file has been quiet this long...
+#define IMAGELOADER_SETTLE_DELAY 300000
+// ...or this long after the first change, if it never is.
+#define IMAGELOADER_SETTLE_MAX 2000000
+// Bytes read from each end of a file for its content fingerprint
+#define IMAGELOADER_FINGERPRINT_SIZE 16384
+// Attribute values up to this size come with the item, others are
+// read on demand through an AttrCache
+#define IMAGELOADER_ATTR_INLINE_SIZE 16
+// Appended to a thumbnail attribute name for the source mtime it was made of
+#define IMAGELOADER_STAMP_SUFFIX ":mtime"
 
 enum {
 	CMD_LOADER_DELETE = 'ldRm',
+	CMD_LOADER_SETTLE = 'ldSt',
+	CMD_LOADER_DETAIL = 'ldLv',
+	CMD_LOADER_WORKERS = 'ldWk',
 	// Replies.
 	MSG_LOADER_UPDATE = 'ldUp',
 	MSG_LOADER_DONE= 'ldDn',
 	MSG_LOADER_DONE_BUT_RUNNING = 'ldDR',
 	MSG_LOADER_DELETED = 'ldDl',
+	MSG_LOADER_BATCH = 'ldBt'
 };
 
 
@@ -47,7 +72,9 @@ enum {
 	LOADER_READ_TAGS = 1,
 	LOADER_READ_EXIF_THUMB = 2,
 	LOADER_RELOAD_EXISTING = 4,
-	LOADER_ONLY_IMAGES = 8
+	LOADER_ONLY_IMAGES = 8,
+	LOADER_WATCH_DIRECTORIES = 16,
+	LOADER_WRITE_THUMBNAILS = 32
 };
 
 #define MAX_QUERIES 10
@@ -56,10 +83,104 @@ enum {
 struct file_item {
 	node_ref nodref;
 	entry_ref entref;
+	bool dirWatched;
+	// last known state, to tell real changes from touches
+	off_t size;
+	time_t mtime;
+	uint32 fingerprint;
 	file_item(node_ref &node);
 };
 
 
+/// HashTable definition, file_item by node
+struct file_node_def {
+	typedef node_ref KeyType;
+	static inline const node_ref& Key(const file_item *item) { return item->nodref; }
+	static inline uint32 Hash(const node_ref &key) { return hash_int64(key.node ^ ((uint64)key.device << 40)); }
+};
+
+
+/// HashTable definition, file_item by entry
+struct file_ref_def {
+	typedef entry_ref KeyType;
+	static inline const entry_ref& Key(const file_item *item) { return item->entref; }
+	static inline uint32 Hash(const entry_ref &key) { return hash_string(key.name, hash_int64(key.directory ^ ((uint64)key.device << 40))); }
+};
+
+
+/// Watched parent directory
+struct dir_item {
+	node_ref nodref;
+	// cached files watched through this directory
+	int32 count;
+	// load files created in here
+	bool addNew;
+	dir_item(const node_ref &node);
+};
+
+
+/// Node monitor changes waiting to settle
+struct node_change {
+	node_ref nodref;
+	// job flags to process the file with
+	uint32 mode;
+	// names of the changed attributes
+	BMessage attrs;
+	bigtime_t first;
+	bigtime_t last;
+	node_change(const node_ref &node);
+};
+
+
+/// HashTable definition, node_change by node
+struct node_change_def {
+	typedef node_ref KeyType;
+	static inline const node_ref& Key(const node_change *item) { return item->nodref; }
+	static inline uint32 Hash(const node_ref &key) { return hash_int64(key.node ^ ((uint64)key.device << 40)); }
+};
+
+
+/// Decoder job flags
+enum {
+	JOB_READ_ATTRIBUTES = 1,
+	JOB_READ_DATA = 2,
+	JOB_DATA_REQUIRED = 4,
+	JOB_PROGRESS = 8,
+	JOB_PLACEHOLDER = 16,
+	JOB_UPDATE_ONLY = 32,
+	JOB_CHECK_CONTENT = 64,
+	JOB_READ_CHANGED_ATTRIBUTES = 128
+};
+
+/// Decoder job priorities, lower goes first
+enum {
+	JOB_PRIORITY_VISIBLE = 0,
+	JOB_PRIORITY_AHEAD = 1,
+	JOB_PRIORITY_NORMAL = 2
+};
+
+/// Pending work for the decoder threads
+struct load_job {
+	entry_ref ref;
+	node_ref node;
+	BMessage reply;
+	uint32 mode;
+	int32 priority;
+	uint32 order;
+	// load generation it belongs to
+	int32 generation;
+	// set when the result is no longer wanted
+	int32 cancelled;
+	// JOB_CHECK_CONTENT: the old fingerprint
+	uint32 fingerprint;
+	// JOB_READ_CHANGED_ATTRIBUTES: their names
+	BMessage attrs;
+	// thumbnail pyramid level, ReadDetail() if above 0
+	int32 level;
+	load_job(const entry_ref &ref, BMessage *reply, uint32 mode);
+};
+
+
 class ImageLoader : public BLooper
 {
 	public:
@@ -69,36 +190,129 @@ class ImageLoader : public BLooper
 	virtual void MessageReceived(BMessage *message);
 	void Stop();
 	bool IsRunning();
+	int32 Generation();
 	void SetAttrNames(const char *attrnames);
 	void SetLoadOptions(uint32 flags);
 	void SetThumbnailSize(float width, float height);
+	void SetThumbnailFormat(uint32 format);
+	void SetWorkerCount(int32 count);
+	void SetViewport(BMessage *message);
+	void SetSelection(BMessage *message);
+	status_t WatchDirectory(const node_ref &dir);
 	virtual void RefsReceived(BMessage *message);
 	virtual void DeleteReceived(BMessage *message);	
 	static BBitmap *ReadImagePreview(entry_ref *ref, float width, float height, BRect *originalBounds = NULL);
-	static BBitmap *ReadThumbnail(BNode *node, const char *attrname);
+	static BBitmap *ReadImagePreview(BPositionIO *file, float width, float height, BRect *originalBounds = NULL);
+	static BBitmap *ScaleBitmap(BBitmap *original, float width, float height);
+	static BBitmap *ReadTiffPreview(BPositionIO *file, float width, float height, BRect *originalBounds,
+		BMessage *tags, uint32 *flags, int32 *cancel = NULL);
+	static BBitmap *ReadThumbnail(BNode *node, const char *attrname, time_t mtime = 0);
+	static status_t WriteThumbnail(BNode *node, const char *attrname, BBitmap *bitmap,
+		uint32 format, time_t mtime);
+	static BBitmap *ReadIcon(BNode *node);
+	static BBitmap *TranslateBitmap(BPositionIO *file, const char *type);
+	static status_t ReadType(BFile *file, BString *type);
 	
 	private:
 
 	void NodeMonitorChange(BMessage *message);
-	bool AddCacheItem(entry_ref &ref, node_ref &noderef);
+	void QueueChange(const node_ref &node, uint32 mode, const char *attr = NULL);
+	void SettleChanges();
+	bool AddCacheItem(entry_ref &ref, node_ref &noderef, const struct stat *st = NULL);
 	bool RemoveCacheItem(entry_ref *ref);
+	void RemoveCacheItems(BObjectList<file_item> *nodes);
+	void UnwatchItem(file_item *item);
+	void WatchParent(const node_ref &dir);
+	void UnwatchParent(const node_ref &dir);
+	void SetNodeWatches(BObjectList<node_ref> *nodes);
+	void GetWatchNodes(BMessage *message, BObjectList<node_ref> *nodes);
+	void UpdateNodeWatches();
 	status_t HandleRef(entry_ref *ref);
-	status_t HandleFile(entry_ref *ref);
+	status_t HandleFile(entry_ref *ref, const struct stat *st);
 	status_t HandleDirectory(entry_ref *ref);
 	status_t HandleTrackerQuery(BNode *node);
+	void DetailReceived(BMessage *message);
 	//status_t LoadFile(entry_ref *ref, BMessage *reply, uint32 mode = 0xff);
-	status_t ReadData(entry_ref *ref, BMessage *reply);
-	status_t ReadStats(entry_ref *ref, BMessage *reply);
+	status_t ReadData(BFile *file, BMessage *reply, int32 *cancel = NULL, uint32 *fingerprint = NULL);
+	status_t ReadDetail(BFile *file, BMessage *reply, int32 level, int32 *cancel = NULL);
+	BBitmap* DecodeBitmap(BFile *file, float width, float height, BRect *originalBounds,
+		BMessage *tags, uint32 *flags, int32 *cancel);
+	status_t ReadStats(entry_ref *ref, BMessage *reply, struct stat *st = NULL);
+	static void AddStats(const struct stat *st, BMessage *reply);
 	status_t ReadAttributes(BNode *node, BMessage *reply);
+	status_t ReadChangedAttributes(BNode *node, BMessage *names, BMessage *reply);
+	static status_t ReadAttribute(BNode *node, const char *name, BMessage *attributes, BMessage *infos);
+	static uint32 Fingerprint(BFile *file);
+	bool ContentUnchanged(load_job *job, BFile *file);
+	void RecordFingerprint(const node_ref &node, uint32 fingerprint);
+	status_t ReadDimensions(BFile *file, BMessage *reply);
+	void ThumbKey(const struct stat *st, thumb_key *key);
+
+	void ResizeWorkers(int32 count);
+	void StartWorkers(int32 count);
+	void StopWorkers();
+	static int32 WorkerThread(void *data);
+	void WorkerLoop();
+	void QueueJob(load_job *job);
+	int32 JobPriority(const entry_ref &ref);
+	void PushJob(load_job *job);
+	load_job* PopJob();
+	void SiftDown(int32 index);
+	void ProcessJob(load_job *job);
+	bool IsCancelled(load_job *job);
+	void CancelJobs(BObjectList<entry_ref> *refs);
+	void DiscardJob(load_job *job);
+	void FailJob(load_job *job, status_t status);
+	void SendDone();
+	void PostUpdate(BMessage *update);
+	void FlushUpdates();
 	
-	BObjectList<file_item> fItems;
+	// Node cache, and an index of the same items by entry_ref
+	HashTable<file_item, file_node_def> fItems;
+	HashTable<file_item, file_ref_def> fRefs;
+	// Directory-level monitoring
+	BObjectList<dir_item> fDirs;
+	BObjectList<node_ref> fNodeWatches;
+	// what the client has on screen, and selected
+	BObjectList<node_ref> fViewWatches, fSelectWatches;
+	// Coalesced stat and attribute changes
+	HashTable<node_change, node_change_def> fChanges;
+	BMessageRunner *fSettleRunner;
 	BObjectList<BQuery> fQueries;
 	bool fRunning;
 	BLocker fStopLocker;
+	// Bumped by Stop(), anything from an older generation is dropped.
+	int32 fGeneration;
+	// Generation of the message being handled, looper thread only
+	int32 fLoadGeneration;
 	uint32 fLoadOptions;
 	int32 fTotal, fDone;
 	float fThumbWidth, fThumbHeight;
 	BString fReadAttr, fWriteAttr;
+	uint32 fWriteFormat;
+	bool fLiveQueries;
+
+	// Decoder pool, fJobs is a binary heap
+	BObjectList<load_job> fJobs;
+	// Jobs being processed, not owned
+	BObjectList<load_job> fActive;
+	BObjectList<entry_ref> fVisible, fAhead;
+	uint32 fJobOrder;
+	BLocker fQueueLock;
+	sem_id fJobSem;
+	thread_id fWorkers[IMAGELOADER_MAX_WORKERS];
+	int32 fWorkerCount;
+	int32 fBusy;
+
+	ThumbnailCache fCache;
+	// levels above 0 of the thumbnail pyramid
+	ThumbnailCache fDetailCache;
+
+	// Pending MSG_LOADER_UPDATE notices
+	BMessage fBatch;
+	int32 fBatchCount;
+	bigtime_t fBatchTime;
+	BLocker fBatchLock;
 	
 };
 
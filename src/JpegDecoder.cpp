@@ -0,0 +1,225 @@
+/**
+\file JpegDecoder.cpp
+\brief Reduced-size JPEG decoding
+
+libjpeg can scale by 1/2, 1/4 or 1/8 while doing the inverse DCT, at 1/8
+only the DC coefficient of each block is used. The largest reduction
+that still covers the requested size is picked, so a multi-megapixel
+photo never gets decoded at full resolution just to be thrown away.
+The result is at most twice the requested size in each direction and
+still needs the final resampling step.
+*/
+
+#include <Debug.h>
+#include <OS.h>
+#include <stdio.h>
+#include <setjmp.h>
+#include <jpeglib.h>
+#include "JpegDecoder.h"
+
+
+/// libjpeg data source reading from a BPositionIO
+struct io_source_mgr {
+	jpeg_source_mgr pub;
+	BPositionIO *io;
+	off_t pos;
+	JOCTET buffer[JPEGDECODER_BUFFER_SIZE];
+};
+
+/// libjpeg error handler that returns to Decode()
+struct jump_error_mgr {
+	jpeg_error_mgr pub;
+	jmp_buf setjmp_buffer;
+};
+
+
+static void io_init_source(j_decompress_ptr cinfo)
+{
+}
+
+
+static boolean io_fill_input_buffer(j_decompress_ptr cinfo)
+{
+	io_source_mgr *src = (io_source_mgr*)cinfo->src;
+	ssize_t n = src->io->ReadAt(src->pos, src->buffer, JPEGDECODER_BUFFER_SIZE);
+	if (n <= 0) {
+		// Truncated file, pretend it ends here.
+		src->buffer[0] = 0xff;
+		src->buffer[1] = JPEG_EOI;
+		n = 2;
+	}
+	else
+		src->pos += n;
+	src->pub.next_input_byte = src->buffer;
+	src->pub.bytes_in_buffer = n;
+	return TRUE;
+}
+
+
+static void io_skip_input_data(j_decompress_ptr cinfo, long count)
+{
+	io_source_mgr *src = (io_source_mgr*)cinfo->src;
+	if (count <= 0)
+		return;
+	if ((size_t)count <= src->pub.bytes_in_buffer) {
+		src->pub.next_input_byte += count;
+		src->pub.bytes_in_buffer -= count;
+	}
+	else {
+		// Skip without reading, big EXIF blocks are common.
+		src->pos += count - src->pub.bytes_in_buffer;
+		src->pub.bytes_in_buffer = 0;
+	}
+}
+
+
+static void io_term_source(j_decompress_ptr cinfo)
+{
+}
+
+
+static void jump_error_exit(j_common_ptr cinfo)
+{
+	jump_error_mgr *err = (jump_error_mgr*)cinfo->err;
+	longjmp(err->setjmp_buffer, 1);
+}
+
+
+static void quiet_output_message(j_common_ptr cinfo)
+{
+#if DEBUG
+	char buffer[JMSG_LENGTH_MAX];
+	(*cinfo->err->format_message)(cinfo, buffer);
+	PRINT(("JpegDecoder: %s\n", buffer));
+#endif
+}
+
+
+JpegDecoder::JpegDecoder(BPositionIO *source):
+	fSource(source),
+	fCancel(NULL)
+{
+}
+
+
+/**
+	Makes Decode() give up and return NULL once '*flag' is non-zero.
+*/
+void JpegDecoder::SetCancelFlag(int32 *flag)
+{
+	fCancel = flag;
+}
+
+
+/**
+	Decodes at the smallest scale that still covers 'width' x 'height'.
+	Returns a B_RGB32 bitmap owned by the caller, or NULL if the data is
+	not a JPEG image libjpeg can handle.
+*/
+BBitmap* JpegDecoder::Decode(float width, float height, BRect *originalBounds)
+{
+	uint8 magic[2];
+	if (fSource->ReadAt(0, magic, 2) != 2 || magic[0] != 0xff || magic[1] != 0xd8)
+		return NULL;
+
+	jpeg_decompress_struct cinfo;
+	jump_error_mgr jerr;
+	io_source_mgr *src = new io_source_mgr;
+	// volatile, it must survive longjmp()
+	BBitmap * volatile bitmap = NULL;
+	JSAMPLE * volatile row = NULL;
+
+	cinfo.err = jpeg_std_error(&jerr.pub);
+	jerr.pub.error_exit = jump_error_exit;
+	jerr.pub.output_message = quiet_output_message;
+	if (setjmp(jerr.setjmp_buffer)) {
+		PRINT(("JpegDecoder: failed.\n"));
+		jpeg_destroy_decompress(&cinfo);
+		delete[] row;
+		delete bitmap;
+		delete src;
+		return NULL;
+	}
+	jpeg_create_decompress(&cinfo);
+
+	src->io = fSource;
+	src->pos = 0;
+	src->pub.init_source = io_init_source;
+	src->pub.fill_input_buffer = io_fill_input_buffer;
+	src->pub.skip_input_data = io_skip_input_data;
+	src->pub.resync_to_restart = jpeg_resync_to_restart;
+	src->pub.term_source = io_term_source;
+	src->pub.bytes_in_buffer = 0;
+	src->pub.next_input_byte = NULL;
+	cinfo.src = &src->pub;
+
+	jpeg_read_header(&cinfo, TRUE);
+	if (originalBounds)
+		originalBounds->Set(0, 0, cinfo.image_width - 1, cinfo.image_height - 1);
+
+	// The fit-to-frame size, as in ImageLoader::ReadImagePreview().
+	float w0 = cinfo.image_width, h0 = cinfo.image_height;
+	if (h0 * width / w0 > height)
+		width = w0 * height / h0;
+	else
+		height = h0 * width / w0;
+	cinfo.scale_num = 1;
+	cinfo.scale_denom = 1;
+	while (cinfo.scale_denom < 8 && w0 / (cinfo.scale_denom * 2) >= width
+		&& h0 / (cinfo.scale_denom * 2) >= height)
+		cinfo.scale_denom *= 2;
+
+	// Speed over precision, this is going to be scaled down anyway.
+	cinfo.dct_method = JDCT_IFAST;
+	cinfo.do_fancy_upsampling = FALSE;
+	cinfo.do_block_smoothing = FALSE;
+	bool cmyk = cinfo.jpeg_color_space == JCS_CMYK || cinfo.jpeg_color_space == JCS_YCCK;
+	cinfo.out_color_space = cmyk ? JCS_CMYK : JCS_RGB;
+
+	jpeg_start_decompress(&cinfo);
+	PRINT(("JpegDecoder: %ux%u at 1/%u.\n", cinfo.image_width, cinfo.image_height, cinfo.scale_denom));
+
+	bitmap = new BBitmap(BRect(0, 0, cinfo.output_width - 1, cinfo.output_height - 1), B_RGB32);
+	if (bitmap->InitCheck() != B_OK)
+		longjmp(jerr.setjmp_buffer, 1);
+	row = new JSAMPLE[cinfo.output_width * cinfo.output_components];
+	// Adobe writes inverted CMYK.
+	bool inverted = cmyk && cinfo.saw_Adobe_marker;
+
+	uint8 *bits = (uint8*)bitmap->Bits();
+	int32 bpr = bitmap->BytesPerRow();
+	JSAMPROW rows[1] = { row };
+	while (cinfo.output_scanline < cinfo.output_height) {
+		if (fCancel && atomic_get(fCancel))
+			longjmp(jerr.setjmp_buffer, 1);
+		uint8 *dst = bits + cinfo.output_scanline * bpr;
+		jpeg_read_scanlines(&cinfo, rows, 1);
+		const JSAMPLE *s = row;
+		if (cmyk) {
+			for (uint32 x = 0; x < cinfo.output_width; x++, s += 4, dst += 4) {
+				uint32 c = s[0], m = s[1], y = s[2], k = s[3];
+				if (!inverted) {
+					c = 255 - c; m = 255 - m; y = 255 - y; k = 255 - k;
+				}
+				dst[0] = y * k / 255;
+				dst[1] = m * k / 255;
+				dst[2] = c * k / 255;
+				dst[3] = 255;
+			}
+		}
+		else {
+			for (uint32 x = 0; x < cinfo.output_width; x++, s += 3, dst += 4) {
+				dst[0] = s[2];
+				dst[1] = s[1];
+				dst[2] = s[0];
+				dst[3] = 255;
+			}
+		}
+	}
+
+	jpeg_finish_decompress(&cinfo);
+	jpeg_destroy_decompress(&cinfo);
+	delete[] row;
+	delete src;
+	return bitmap;
+}
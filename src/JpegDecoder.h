@@ -0,0 +1,26 @@
+#ifndef _JPEGDECODER_H_
+#define _JPEGDECODER_H_
+
+#include <Bitmap.h>
+#include <DataIO.h>
+
+#define JPEGDECODER_BUFFER_SIZE 16384
+
+/**
+	Decodes JPEG images straight to thumbnail size.
+*/
+class JpegDecoder
+{
+	public:
+
+	JpegDecoder(BPositionIO *source);
+	void SetCancelFlag(int32 *flag);
+	BBitmap* Decode(float width, float height, BRect *originalBounds = NULL);
+
+	private:
+
+	BPositionIO *fSource;
+	int32 *fCancel;
+};
+
+#endif
@@ -23,10 +23,13 @@ SOFTWARE.
 */
 
 #include <Debug.h>
+#include <stdio.h>
+#include <time.h>
 #include <String.h>
 #include <libiptcdata/iptc-data.h>
 #include <libiptcdata/iptc-jpeg.h>
 #include <JpegTagExtractor.h>
+#include "IfdWalker.h"
 
 #include <netinet/in.h>
 
@@ -129,6 +132,50 @@ status_t JpegTagExtractor::Extract(BMessage *tags, uint32 *features)
 }
 
 
+/**
+	Finds the image size in the Start-of-Frame marker.
+	Skips over all other segments without reading them, so it costs
+	only a few small reads even with big EXIF blocks in front.
+	The JPEG data starts at 'start', the SOF marker found goes to 'sof'.
+	\returns B_BAD_VALUE if not a JPEG file.
+*/
+status_t JpegTagExtractor::ReadSize(BPositionIO *posio, int16 *width, int16 *height, off_t start, uint8 *sof)
+{
+	uint8 buf[9];
+	if (posio->ReadAt(start, buf, 2) < 2 || buf[0] != 0xff || buf[1] != SOI)
+		return B_BAD_VALUE;
+	off_t pos = start + 2;
+	while (posio->ReadAt(pos, buf, 4) == 4) {
+		if (buf[0] != 0xff)
+			return B_ERROR;
+		int c = buf[1];
+		if (c == 0xff) {
+			// fill byte
+			pos++;
+			continue;
+		}
+		if (c == SOI || c == TEM || (c >= RST0 && c <= RST7)) {
+			pos += 2;
+			continue;
+		}
+		if (c == SOS || c == EOI)
+			break;
+		uint16 size = (buf[2] << 8) | buf[3];
+		if (c >= SOF0 && c <= SOF15 && c != DHT && c != DAC && c != 0xc8) {
+			if (size < 7 || posio->ReadAt(pos + 4, buf, 5) != 5)
+				return B_ERROR;
+			*height = (buf[1] << 8) | buf[2];
+			*width = (buf[3] << 8) | buf[4];
+			if (sof)
+				*sof = c;
+			return B_OK;
+		}
+		pos += 2 + size;
+	}
+	return B_ERROR;
+}
+
+
 /**
 	Copies the pointer to raw thumbnail data and returns its size.
 	If 'detach' is true the caller takes over the ownership,
@@ -146,55 +193,195 @@ size_t JpegTagExtractor::GetThumbnailData(void **data, bool detach)
 
 
 /**
-    Gets EXIF tags from an IFD block.
-    'data' points to the TIFF header start.
+	Parses an EXIF "YYYY:MM:DD HH:MM:SS" local time.
 */
-int JpegTagExtractor::ReadIFD(exif_ifd_t *ifd, uint8 *data, int ofs, bool skip)
+static bool parse_date(const char *s, time_t *time)
 {
-    ofs = read_ifd(ifd, data, ofs);
-    if (ofs) {
-    	void *thumb = NULL;
-    	int thumbsize = 0;
-        exif_tag_t tag;
-        char buf[0x1000];
-        for (int i=0; i < ifd->size; i++) {
-            ofs = read_ifd_tag(ifd, &tag, data, ofs);
-            if (!ofs)
-            	break;
-            // only relevant tags
-			const char *tagname = exif_descr(exif_tag_name, tag.number);
-            if (!skip && tagname) {
-            	BString prefix = "EXIF:";
-            	prefix += tagname;
-            	//PRINT(("%X %s(%d): %d\n", tag.number, tagname, tag.format, tag.value));
-            	if (exif_str(buf, &tag))
-            		TagExtracted('EXIF', tag.number, prefix.String(), B_STRING_TYPE, buf, strlen(buf)+1);
-        	}
-            if (tag.number == EXIF_JPEG_INTERCHANGE_FORMAT)
-            	// thumbnail offset in 'data'
-                thumb = data + tag.value;
-            else if (tag.number == EXIF_JPEG_INTERCHANGE_FORMAT_LENGTH)
-            	thumbsize = tag.value;
-        }
+	// digit positions
+	static const int kFields[6][2] = { {0, 4}, {5, 2}, {8, 2}, {11, 2}, {14, 2}, {17, 2} };
+	int values[6];
+	if (strlen(s) < 19)
+		return false;
+	for (int i = 0; i < 6; i++) {
+		values[i] = 0;
+		for (int j = kFields[i][0]; j < kFields[i][0] + kFields[i][1]; j++) {
+			if (s[j] < '0' || s[j] > '9')
+				return false;
+			values[i] = values[i] * 10 + s[j] - '0';
+		}
+	}
+	// blank dates are all zeros
+	if (values[0] < 1900 || values[1] < 1 || values[2] < 1)
+		return false;
+	struct tm tm;
+	memset(&tm, 0, sizeof(tm));
+	tm.tm_year = values[0] - 1900;
+	tm.tm_mon = values[1] - 1;
+	tm.tm_mday = values[2];
+	tm.tm_hour = values[3];
+	tm.tm_min = values[4];
+	tm.tm_sec = values[5];
+	tm.tm_isdst = -1;
+	*time = mktime(&tm);
+	return *time != (time_t)-1;
+}
 
-		//PRINT(("IFD %d %d\n", ifd->ofs, ifd->size));
 
-        // store the thumbnail if complete and new
-	    if (thumb && thumbsize && !fThumbnailData) {
-	    	fThumbnailData = malloc(thumbsize);
-	    	memcpy(fThumbnailData, thumb, thumbsize);
-	    	fThumbnailSize = thumbsize;
-	    	PRINT(("EXIF thumbnail: %d bytes\n", thumbsize));
-	    }
-    }
-    return ofs;
+/**
+	Makes a readable string of a tag stored by Extract().
+	Only enumerated EXIF values need this, NameValueItem handles the rest.
+	\returns false if there is nothing to translate.
+*/
+bool JpegTagExtractor::FormatTag(const char *name, type_code type, const void *data, BString *text)
+{
+	if (strncmp(name, "EXIF:", 5) != 0 || (type != B_UINT32_TYPE && type != B_INT32_TYPE))
+		return false;
+	int number = exif_tag_number(name + 5);
+	if (number < 0)
+		return false;
+	exif_tag_t tag;
+	memset(&tag, 0, sizeof(tag));
+	tag.number = number;
+	tag.format = type == B_UINT32_TYPE ? FORMAT_ULONG : FORMAT_SLONG;
+	tag.components = 1;
+	tag.value = *(const uint32*)data;
+	char buf[64];
+	if (!exif_str(buf, sizeof(buf), &tag))
+		return false;
+	text->SetTo(buf);
+	return true;
+}
+
+
+/**
+    Gets EXIF tags from an IFD block.
+    'tiff' points to the TIFF header start, 'size' bytes are valid.
+    Returns the number of entries, the offsets of the next IFD and of
+    the EXIF sub-IFD go to 'next' and 'sub', 0 if none.
+*/
+template <class Order>
+int JpegTagExtractor::ReadIFD(const uint8 *tiff, uint32 size, uint32 ofs, bool skip, uint32 *next, uint32 *sub)
+{
+	IfdWalker<Order> ifd(tiff, size, ofs);
+	*next = ifd.Next();
+	*sub = 0;
+	const uint8 *thumb = NULL;
+	uint32 thumbofs = 0;
+	uint32 thumbsize = 0;
+	char buf[0x1000];
+	for (int32 i = 0; i < ifd.CountEntries(); i++) {
+		IfdEntry<Order> entry = ifd.EntryAt(i);
+		uint16 number = entry.Tag();
+		if (number == EXIF_IFD_POINTER) {
+			*sub = entry.UInt();
+			continue;
+		}
+		if (number == EXIF_JPEG_INTERCHANGE_FORMAT)
+			// thumbnail offset in 'tiff'
+			thumbofs = entry.UInt();
+		else if (number == EXIF_JPEG_INTERCHANGE_FORMAT_LENGTH)
+			thumbsize = entry.UInt();
+		// only relevant tags
+		const char *tagname = skip ? NULL : exif_tag_descr(number);
+		if (!tagname)
+			continue;
+		// "EXIF:" + tagname, without allocating
+		char name[64] = "EXIF:";
+		size_t length = strlen(tagname);
+		if (length > sizeof(name) - 6)
+			length = sizeof(name) - 6;
+		memcpy(name + 5, tagname, length);
+		name[5 + length] = 0;
+		// Values are stored in their own type, FormatTag() makes them readable.
+		uint32 bytes = entry.ByteSize();
+		switch (entry.Format()) {
+			case FORMAT_STRING: {
+				const char *value = (const char*)entry.Value();
+				if (!value)
+					break;
+				if (bytes >= sizeof(buf))
+					bytes = sizeof(buf) - 1;
+				length = strnlen(value, bytes);
+				memcpy(buf, value, length);
+				buf[length] = 0;
+				time_t time;
+				if ((number == EXIF_DATE_TIME || number == EXIF_DATE_TIME_ORIGINAL
+					|| number == EXIF_DATE_TIME_DIGITIZED) && parse_date(buf, &time))
+					TagExtracted('EXIF', number, name, B_TIME_TYPE, &time, sizeof(time));
+				else
+					TagExtracted('EXIF', number, name, B_STRING_TYPE, buf, length+1);
+				break;
+			}
+			case FORMAT_BYTE:
+			case FORMAT_USHORT:
+			case FORMAT_ULONG: {
+				uint32 value = entry.UInt();
+				TagExtracted('EXIF', number, name, B_UINT32_TYPE, &value, sizeof(value));
+				break;
+			}
+			case FORMAT_SBYTE:
+			case FORMAT_SSHORT:
+			case FORMAT_SLONG: {
+				int32 value = entry.UInt();
+				if (entry.Format() == FORMAT_SBYTE)
+					value = (int8)value;
+				else if (entry.Format() == FORMAT_SSHORT)
+					value = (int16)value;
+				TagExtracted('EXIF', number, name, B_INT32_TYPE, &value, sizeof(value));
+				break;
+			}
+			case FORMAT_URATIONAL:
+			case FORMAT_SRATIONAL: {
+				int32 numerator, denominator;
+				if (!entry.Rational(0, &numerator, &denominator) || denominator == 0)
+					break;
+				double value = entry.Format() == FORMAT_URATIONAL
+					? (double)(uint32)numerator / (uint32)denominator
+					: (double)numerator / denominator;
+				TagExtracted('EXIF', number, name, B_DOUBLE_TYPE, &value, sizeof(value));
+				break;
+			}
+			case FORMAT_UNDEFINED: {
+				if (bytes > 4)
+					// maker notes and such
+					break;
+				if (number == EXIF_EXIF_VERSION || number == EXIF_FLASH_PIX_VERSION) {
+					exif_tag_t tag;
+					memset(&tag, 0, sizeof(tag));
+					tag.number = number;
+					tag.format = FORMAT_UNDEFINED;
+					tag.value = entry.UInt();
+					if (exif_str(buf, sizeof(buf), &tag))
+						TagExtracted('EXIF', number, name, B_STRING_TYPE, buf, strlen(buf)+1);
+					break;
+				}
+				// enumerations, first byte lowest
+				uint32 value = entry.UInt();
+				TagExtracted('EXIF', number, name, B_UINT32_TYPE, &value, sizeof(value));
+				break;
+			}
+		}
+	}
+	if (thumbofs && thumbofs < size && thumbsize <= size - thumbofs)
+		thumb = tiff + thumbofs;
+
+	// store the thumbnail if complete and new
+	if (thumb && thumbsize && !fThumbnailData) {
+		fThumbnailData = malloc(thumbsize);
+		if (fThumbnailData) {
+			memcpy(fThumbnailData, thumb, thumbsize);
+			fThumbnailSize = thumbsize;
+			PRINT(("EXIF thumbnail: %ld bytes\n", thumbsize));
+		}
+	}
+	return ifd.CountEntries();
 }
 
 
 /**
 	Gets IPTC tags from an APP13 block.
 */
-int JpegTagExtractor::ReadIPTC(uint8 *data, int size)
+int JpegTagExtractor::ReadIPTC(const uint8 *data, int size)
 {
     unsigned int iptc_len = 0;
     int iptc_off = iptc_jpeg_ps3_find_iptc (data, size, &iptc_len);
@@ -209,15 +396,29 @@ int JpegTagExtractor::ReadIPTC(uint8 *data, int size)
             BString name = "IPTC:";
             name += iptc_tag_get_name(e->record, e->tag);
             switch (iptc_dataset_get_format (e)) {
-				//TODO: store different types
                 case IPTC_FORMAT_BYTE:
                 case IPTC_FORMAT_SHORT:
-                case IPTC_FORMAT_LONG:
-                case IPTC_FORMAT_DATE:
+                case IPTC_FORMAT_LONG: {
+                    uint32 value = iptc_dataset_get_value(e);
+                    TagExtracted('IPTC', e->tag, name.String(), B_UINT32_TYPE, &value, sizeof(value));
+                    break;
+                }
+                case IPTC_FORMAT_DATE: {
+                    int year, month, day;
+                    if (iptc_dataset_get_date(e, &year, &month, &day) == 0) {
+                        snprintf(buf, sizeof(buf), "%04d:%02d:%02d 00:00:00", year, month, day);
+                        time_t time;
+                        if (parse_date(buf, &time)) {
+                            TagExtracted('IPTC', e->tag, name.String(), B_TIME_TYPE, &time, sizeof(time));
+                            break;
+                        }
+                    }
+                    // fall through, not a valid date
+                }
                 case IPTC_FORMAT_TIME:
 				default:
                     iptc_dataset_get_as_str(e, buf, sizeof(buf));
-                    TagExtracted('IPTC', e->tag, name.String(), B_STRING_TYPE, buf, e->size+1);
+                    TagExtracted('IPTC', e->tag, name.String(), B_STRING_TYPE, buf, strlen(buf)+1);
                     break;
             }
         }
@@ -231,50 +432,57 @@ int JpegTagExtractor::ReadIPTC(uint8 *data, int size)
 int JpegTagExtractor::ReadAPP0()
 {
     uint16 size;
-    if (Read(&size, 2) < 2)
+    if (Read(&size, 2) < 2 || ntohs(size) < 2)
         return -1;
     size = ntohs(size)-2;
-	// JFIF header
-    char data[size];
-    if (Read(data, size) < size)
+	// JFIF header, not used
+    if (Read(NULL, size) < size)
         return -1;
 	return 0;
 };
 
 /**
     Reads APP1 marker.
-    Should contain EXIF data.
+    Should contain EXIF data, which is parsed in place.
 */
 int JpegTagExtractor::ReadAPP1()
 {
     uint16 size;
-    if (Read(&size, 2) < 2)
+    if (Read(&size, 2) < 2 || ntohs(size) < 2)
         return -1;
     size = ntohs(size) - 2;
+    const uint8 *data = ReadBlock(size);
     // EXIF identifier
-    char identifier[6];
-    if (Read(identifier, 6) < 6 || strcmp(identifier,"Exif") != 0)
+    if (!data || size < 6 || memcmp(data, "Exif\0\0", 6) != 0)
         return -1;
     // TIFF header
-    uint8 data[size-6];
-    if (Read(data, size-6) < size-6)
-        return -1;
-    int16 ifd0magic = *(uint16*)(data+2);
-    int32 ifd0ofs = *(uint32*)(data+4);
-    if (data[0] == 'M') {
-    	ifd0magic = ntohs(ifd0magic);
-    	ifd0ofs = ntohl(ifd0ofs);
-    }
-    if (ifd0magic != 42)
+    const uint8 *tiff = data + 6;
+    uint32 tiffsize = size - 6;
+    bool bigEndian;
+    uint32 ifd0ofs = tiff_header(tiff, tiffsize, &bigEndian);
+    if (!ifd0ofs)
     	return -1;
-    exif_ifd_t ifd0, subifd, ifd1;
-    ReadIFD(&ifd0, data, ifd0ofs);
-    ReadIFD(&subifd, data, ifd0.sub);
-    if (!fSkipThumbnail) {
+    if (bigEndian)
+    	return ReadIFDs<tiff_big_endian>(tiff, tiffsize, ifd0ofs);
+    return ReadIFDs<tiff_little_endian>(tiff, tiffsize, ifd0ofs);
+}
+
+
+/**
+	Reads IFD0, the EXIF sub-IFD and the thumbnail IFD1.
+*/
+template <class Order>
+int JpegTagExtractor::ReadIFDs(const uint8 *tiff, uint32 size, uint32 ifd0ofs)
+{
+	uint32 next, sub, dummy;
+	int count = ReadIFD<Order>(tiff, size, ifd0ofs, false, &next, &sub);
+	if (sub)
+		ReadIFD<Order>(tiff, size, sub, false, &dummy, &dummy);
+	if (!fSkipThumbnail && next) {
 		// Thumbnail, do not extract tags, just data
-		ReadIFD(&ifd1, data, ifd0.next, true);
-    }
-  	return ifd0.size;
+		ReadIFD<Order>(tiff, size, next, true, &dummy, &dummy);
+	}
+	return count;
 }
 
 
@@ -286,12 +494,12 @@ int JpegTagExtractor::ReadAPP1()
 int JpegTagExtractor::ReadAPP13()
 {
     uint16 size;
-    if (Read(&size, 2) < 2)
+    if (Read(&size, 2) < 2 || ntohs(size) < 2)
         return -1;
     size = ntohs(size)-2;
 
-    uint8 data[size];
-    if (Read(data, size) < size)
+    const uint8 *data = ReadBlock(size);
+    if (!data)
         return -1;
 
     int n =  ReadIPTC(data, size);
@@ -306,16 +514,16 @@ int JpegTagExtractor::ReadAPP13()
 int JpegTagExtractor::ReadCOM()
 {
     uint16 size;
-    if (Read(&size, 2) < 2)
+    if (Read(&size, 2) < 2 || ntohs(size) < 2)
         return -1;
 	// string + NUL follows
     size = ntohs(size) -2;
-    char data[size];
-    if (Read(data, size) < size)
+    const char *data = (const char*)ReadBlock(size);
+    if (!data)
     	return -1;
     // zero-terminate the comment
-    data[size-1] = 0;
-	TagExtracted('JPEG', 0xff, "Comment", B_STRING_TYPE, data, strlen(data)+1);
+    BString comment(data, size);
+	TagExtracted('JPEG', 0xff, "Comment", B_STRING_TYPE, (void*)comment.String(), comment.Length()+1);
     return 0;
 }
 
@@ -329,14 +537,21 @@ int JpegTagExtractor::ReadSOF()
     uint16 size;
     if (Read(&size, 2) < 2)
         return -1;
-    size = ntohs(size) -2;
-    char data[size];
-    if (Read(data, 5) < 5)
+    // precision, height, width, components
+    uint8 data[6];
+    if (Read(data, 6) < 6)
     	return -1;
-	uint16 height = ntohs(*(uint16*)(data+1));
-	uint16 width = ntohs(*(uint16*)(data+3));
+	uint16 height = (data[1] << 8) | data[2];
+	uint16 width = (data[3] << 8) | data[4];
+	int16 depth = data[0] * data[5];
     TagExtracted('JPEG', 2, "Width", B_INT16_TYPE, &width, 2);
     TagExtracted('JPEG', 3, "Height", B_INT16_TYPE, &height, 2);
+    TagExtracted('JPEG', 4, "Depth", B_INT16_TYPE, &depth, 2);
     return 0;	
 }
 
+
+
+// TiffTagExtractor reads its IFDs with these.
+template int JpegTagExtractor::ReadIFDs<tiff_big_endian>(const uint8 *tiff, uint32 size, uint32 ifd0ofs);
+template int JpegTagExtractor::ReadIFDs<tiff_little_endian>(const uint8 *tiff, uint32 size, uint32 ifd0ofs);
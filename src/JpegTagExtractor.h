@@ -24,6 +24,7 @@ SOFTWARE.
 #define _JPEGTAGEXTRACTOR_H_
 
 #include <TagExtractor.h>
+#include <String.h>
 #include <exif.h>
 
 enum {
@@ -44,20 +45,30 @@ class JpegTagExtractor: public TagExtractor
 
     virtual status_t Extract(BMessage *tags, uint32 *features = NULL);
     size_t GetThumbnailData(void **data, bool detach);
+    static status_t ReadSize(BPositionIO *posio, int16 *width, int16 *height, off_t start = 0, uint8 *sof = NULL);
+    static bool FormatTag(const char *name, type_code type, const void *data, BString *text);
     
+    protected:
+
+    // EXIF blocks, also used for TIFF files
+    template <class Order>
+    int ReadIFD(const uint8 *tiff, uint32 size, uint32 ofs, bool skip, uint32 *next, uint32 *sub);
+    template <class Order>
+    int ReadIFDs(const uint8 *tiff, uint32 size, uint32 ifd0ofs);
+
+    void* fThumbnailData;
+    size_t fThumbnailSize;
+
     private:
 
     // JPEG Application Marker processing
-    int ReadIFD(exif_ifd_t *ifd, uint8 *data, int ofs, bool skip = false);
-    int ReadIPTC(uint8 *data, int size);
+    int ReadIPTC(const uint8 *data, int size);
     int ReadAPP0();
     int ReadAPP1();
     int ReadAPP13();
     int ReadCOM();
     int ReadSOF();
     
-    void* fThumbnailData;
-    size_t fThumbnailSize;
     bool fSkipThumbnail;
 };
 
@@ -12,6 +12,7 @@
 #include <PopUpMenu.h>
 #include "MainSidebar.h"
 #include "MainWindow.h"
+#include "JpegTagExtractor.h"
 #include "App.h"
 
 
@@ -219,8 +220,9 @@ int cmp_name(const NameValueItem *a, const NameValueItem *b)
 
 /**
 	Copies message fields.
+	Tags are stored typed and made readable only here.
 */
-void AddFields(BObjectList<NameValueItem> *fields, BMessage *source)
+void AddFields(BObjectList<NameValueItem> *fields, BMessage *source, bool tags = false)
 {
 	char *name;
 	type_code type;
@@ -229,6 +231,9 @@ void AddFields(BObjectList<NameValueItem> *fields, BMessage *source)
 		ssize_t size;
 		for (int i = 0; source->FindData(name, type, i, &data, &size) == B_OK; i++) {
 			NameValueItem newitem(name, type, data, size);
+			BString text;
+			if (tags && JpegTagExtractor::FormatTag(name, type, data, &text))
+				newitem.SetValue(text.String());
 			// Only a few datatypes are supported.
 			newitem.SetReadOnly(type != B_STRING_TYPE);
 			NameValueItem *item = (NameValueItem*)fields->BinarySearch(newitem, cmp_name);
@@ -413,9 +418,13 @@ int MainSidebar::ShowSummary()
 				mtime = item->fMTime;
 		}
 		if (fUpdateTags)
-			AddFields(&fTags, &item->fTags);
-		if (fUpdateAttrs)
-			AddFields(&fAttrs, &item->fAttributes);
+			AddFields(&fTags, &item->fTags, true);
+		if (fUpdateAttrs) {
+			// only the small values are there, fetch the rest
+			BMessage values(item->fAttributes);
+			fAttrCache.GetValues(item->Ref(), &item->fAttrInfo, &values);
+			AddFields(&fAttrs, &values);
+		}
 		count++;
 	}
 	
@@ -486,3 +495,12 @@ void MainSidebar::GetSelectedAttrs(BMessage *attrs)
 }
 
 
+/**
+	Drops attribute values read for 'ref', they have changed.
+*/
+void MainSidebar::InvalidateAttrs(const entry_ref &ref)
+{
+	fAttrCache.Invalidate(ref);
+}
+
+
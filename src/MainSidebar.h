@@ -2,6 +2,7 @@
 #define _MAINSIDEBAR_H_
 
 #include <MainView.h>
+#include "AttrCache.h"
 
 class BView;
 class BTextControl;
@@ -36,6 +37,7 @@ class MainSidebar : public BView
 	void Update(uint32 mask = 0xffff);
 	void GetSelectedTags(BMessage *tags);
 	void GetSelectedAttrs(BMessage *attrs);
+	void InvalidateAttrs(const entry_ref &ref);
 
 
 	private:
@@ -43,6 +45,7 @@ class MainSidebar : public BView
 	bool fUpdateStats, fUpdateTags, fUpdateAttrs;
 	AlbumView *fMain;
 	BObjectList<NameValueItem> fTags, fAttrs, fGroups;	
+	AttrCache fAttrCache;
 
 	BOutlineListView *fTagList;
 	BOutlineListView *fAttrList;
@@ -62,10 +62,10 @@ MainToolbar::MainToolbar(BRect frame, uint32 resizing):
 	AddChild(fMark);
 
     // Magnifier
-    fScaler = new BSlider(BRect(0, 0, 100, 24), "Magnify", NULL, new BMessage(MSG_TOOLBAR_ZOOM), 6, 20); 
+    fScaler = new BSlider(BRect(0, 0, 100, 24), "Magnify", NULL, new BMessage(MSG_TOOLBAR_ZOOM), 6, 80); 
 	fScaler->SetModificationMessage(new BMessage('zoom'));
 	fScaler->SetHashMarks(B_HASH_MARKS_BOTH);
-	fScaler->SetHashMarkCount(3);
+	fScaler->SetHashMarkCount(5);
     fScaler->SetValue(20);
     fScaler->SetSnoozeAmount(10000);
 #ifdef __HAIKU__    
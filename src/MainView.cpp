@@ -15,6 +15,19 @@
 #include "MainWindow.h"
 
 
+/**
+	BObjectList CompareFunction, entry_ref order.
+*/
+static int item_ref_cmp(const item_ref *a, const item_ref *b)
+{
+	if (a->ref.device != b->ref.device)
+		return a->ref.device < b->ref.device ? -1 : 1;
+	if (a->ref.directory != b->ref.directory)
+		return a->ref.directory < b->ref.directory ? -1 : 1;
+	return strcmp(a->ref.name, b->ref.name);
+}
+
+
 /**
 	BObjectList EachFunction
 */
@@ -80,6 +93,40 @@ int AlbumFileItem::CmpMTime(const AlbumItem *a, const AlbumItem *b)
 }
 
 
+/**
+	BObjectList CompareFunction
+	Oldest first, items without a capture time go last.
+*/
+int AlbumFileItem::CmpTaken(const AlbumItem *a, const AlbumItem *b)
+{
+	const AlbumFileItem *p0 = dynamic_cast<const AlbumFileItem*>(a);
+	const AlbumFileItem *p1 = dynamic_cast<const AlbumFileItem*>(b);
+	if (p0->fTaken == p1->fTaken)
+		return p0->fSerial - p1->fSerial;
+	if (!p0->fTaken || !p1->fTaken)
+		return p0->fTaken ? -1 : 1;
+	return p0->fTaken < p1->fTaken ? -1 : 1;
+}
+
+
+/**
+	BObjectList CompareFunction
+	Fewest pixels first, items of unknown size go last.
+*/
+int AlbumFileItem::CmpPixels(const AlbumItem *a, const AlbumItem *b)
+{
+	const AlbumFileItem *p0 = dynamic_cast<const AlbumFileItem*>(a);
+	const AlbumFileItem *p1 = dynamic_cast<const AlbumFileItem*>(b);
+	int32 n0 = (int32)p0->fImgWidth * p0->fImgHeight;
+	int32 n1 = (int32)p1->fImgWidth * p1->fImgHeight;
+	if (n0 == n1)
+		return p0->fSerial - p1->fSerial;
+	if (n0 <= 0 || n1 <= 0)
+		return n0 > 0 ? -1 : 1;
+	return n0 < n1 ? -1 : 1;
+}
+
+
 /**
 	BObjectList CompareFunction
 */
@@ -107,6 +154,8 @@ AlbumFileItem::AlbumFileItem(BRect frame, BBitmap *bitmap):
 	AlbumItem(frame, bitmap)
 {
 	fPadding = 10;
+	fImgWidth = fImgHeight = 0;
+	fTaken = 0;
 	// for "no order" sorting
 	static int counter = 0;
 	fSerial = counter++;
@@ -243,7 +292,11 @@ const uint32 AlbumFileItem::Serial()
 */
 MainView::MainView(BRect frame, BMessage *message, uint32 resizing):
 	AlbumView(frame, "Browser", message, resizing, B_PULSE_NEEDED),
-	fNoDataMsg(S_DROPFILES)
+	fNoDataMsg(S_DROPFILES),
+	fViewportCount(-1),
+	fScrollUp(false),
+	fIndex(256, true),
+	fDetailed(16, true)
 {
 }
 
@@ -330,6 +383,88 @@ void MainView::Pulse()
 			InvalidateItem(item);
 		}
 	}
+	CheckViewport();
+}
+
+
+/**
+	Items may have moved, check the viewport on the next pulse.
+*/
+void MainView::Arrange(bool invalidate)
+{
+	AlbumView::Arrange(invalidate);
+	fViewportCount = -1;
+}
+
+
+/**
+	Tells the window which items without a bitmap are on screen, 
+	and which are one page ahead in the scroll direction, 
+	so they can be loaded first. The items on screen are watched.
+	When zoomed in, visible items also ask for a bigger "detail" thumbnail.
+	Items are laid out in order, so the walk ends below the viewport.
+*/
+void MainView::CheckViewport()
+{
+	BRect bounds = Bounds();
+	if (bounds == fViewport && CountItems() == fViewportCount)
+		return;
+	if (bounds.top != fViewport.top)
+		fScrollUp = bounds.top < fViewport.top;
+	fViewport = bounds;
+	fViewportCount = CountItems();
+
+	BRect ahead = bounds.OffsetByCopy(0, fScrollUp ? -bounds.Height() : bounds.Height());
+	float zoom = Zoom();
+	// the detail level that stays sharp at this zoom
+	int32 level = 0;
+	while (level < ALBUMITEM_LEVELS - 1 && (1 << level) < zoom)
+		level++;
+	float end = bounds.bottom > ahead.bottom ? bounds.bottom : ahead.bottom;
+	BMessage msg(MSG_VIEWPORT_CHANGED);
+	for (int i = 0; i < CountItems(); i++) {
+		AlbumFileItem *item = dynamic_cast<AlbumFileItem*>(ItemAt(i));
+		if (!IsItemVisible(item))
+			continue;
+		BRect r = item->Frame();
+		r.Set(r.left*zoom, r.top*zoom, r.right*zoom, r.bottom*zoom);
+		if (r.top > end)
+			break;
+		bool visible = r.Intersects(bounds);
+		// what the user sees should stay up-to-date
+		if (visible)
+			msg.AddRef("watch", &item->Ref());
+		if (item->Bitmap()) {
+			if (visible && level > item->DetailLevel() && !item->Detail(level)
+				&& !(item->Flags() & ALBUMITEM_ICON)) {
+				msg.AddRef("detail", &item->Ref());
+				if (item->DetailLevel() == 0)
+					fDetailed.AddItem(new entry_ref(item->Ref()));
+				item->SetDetailLevel(level);
+			}
+			continue;
+		}
+		if (visible)
+			msg.AddRef("visible", &item->Ref());
+		else if (r.Intersects(ahead))
+			msg.AddRef("ahead", &item->Ref());
+	}
+	// Details are big, keep them only around the viewport.
+	for (int32 i = fDetailed.CountItems() - 1; i >= 0; i--) {
+		AlbumFileItem *item = FindItem(*fDetailed.ItemAt(i));
+		if (item && IsItemVisible(item)) {
+			BRect r = item->Frame();
+			r.Set(r.left*zoom, r.top*zoom, r.right*zoom, r.bottom*zoom);
+			if (r.Intersects(bounds) || r.Intersects(ahead))
+				continue;
+		}
+		if (item)
+			item->ClearDetails();
+		delete fDetailed.RemoveItemAt(i);
+	}
+	if (msg.HasRef("detail"))
+		msg.AddInt32("level", level);
+	Window()->PostMessage(&msg);
 }
 
 
@@ -346,6 +481,108 @@ bool MainView::IsItemVisible(AlbumItem *item)
 }
 
 
+/**
+	Adds an item and indexes it by its ref, which must be set already.
+*/
+AlbumItem* MainView::AddItem(AlbumItem *item, int32 index)
+{
+	if (!AlbumView::AddItem(item, index))
+		return NULL;
+	AlbumFileItem *fileItem = dynamic_cast<AlbumFileItem*>(item);
+	if (fileItem) {
+		item_ref *entry = new item_ref;
+		entry->ref = fileItem->Ref();
+		entry->item = fileItem;
+		fIndex.BinaryInsert(entry, item_ref_cmp);
+	}
+	return item;
+}
+
+
+AlbumItem* MainView::RemoveItem(int32 index)
+{
+	AlbumItem *item = AlbumView::RemoveItem(index);
+	AlbumFileItem *fileItem = dynamic_cast<AlbumFileItem*>(item);
+	if (fileItem) {
+		item_ref key;
+		key.ref = fileItem->Ref();
+		const item_ref *entry = fIndex.BinarySearch(key, item_ref_cmp);
+		if (entry)
+			fIndex.RemoveItem(const_cast<item_ref*>(entry), true);
+	}
+	return item;
+}
+
+
+void MainView::DeleteSelected()
+{
+	AlbumView::DeleteSelected();
+	RebuildIndex();
+}
+
+
+/**
+	Selected items are watched too, so tell the loader.
+	Only done when the selection changes, not on every scroll.
+*/
+void MainView::SelectionChanged()
+{
+	BMessage msg(MSG_SELECTION_CHANGED);
+	for (int32 i = 0; i < CountItems(); i++) {
+		AlbumFileItem *item = dynamic_cast<AlbumFileItem*>(ItemAt(i));
+		if (item && item->IsSelected() && IsItemVisible(item))
+			msg.AddRef("watch", &item->Ref());
+	}
+	Window()->PostMessage(&msg);
+}
+
+
+/**
+	Finds an item by its ref in O(log n).
+*/
+AlbumFileItem* MainView::FindItem(const entry_ref &ref)
+{
+	item_ref key;
+	key.ref = ref;
+	const item_ref *entry = fIndex.BinarySearch(key, item_ref_cmp);
+	return entry ? entry->item : NULL;
+}
+
+
+/**
+	Changes the ref of an item, keeping the index in order.
+*/
+void MainView::SetItemRef(AlbumFileItem *item, entry_ref &ref)
+{
+	item_ref key;
+	key.ref = item->Ref();
+	const item_ref *entry = fIndex.BinarySearch(key, item_ref_cmp);
+	if (entry)
+		fIndex.RemoveItem(const_cast<item_ref*>(entry), true);
+	item->SetRef(ref);
+	item_ref *added = new item_ref;
+	added->ref = ref;
+	added->item = item;
+	fIndex.BinaryInsert(added, item_ref_cmp);
+}
+
+
+void MainView::RebuildIndex()
+{
+	fIndex.MakeEmpty();
+	for (int32 i = 0; i < CountItems(); i++) {
+		AlbumFileItem *item = dynamic_cast<AlbumFileItem*>(ItemAt(i));
+		if (!item)
+			continue;
+		item_ref *entry = new item_ref;
+		entry->ref = item->Ref();
+		entry->item = item;
+		fIndex.AddItem(entry);
+	}
+	fIndex.SortItems(item_ref_cmp);
+}
+
+
 void MainView::SortItems()
 {
 	AlbumView::SortItems();
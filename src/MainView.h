@@ -26,9 +26,13 @@ class AlbumFileItem : public AlbumItem {
 	public:
 	
 	BMessage fTags, fAttributes;
+	// attr_info of all attributes, fAttributes has only the small ones
+	BMessage fAttrInfo;
 	int16 fImgWidth, fImgHeight;
 	off_t fFSize;
 	time_t fCTime, fMTime;	
+	// capture time from the tags, 0 if unknown
+	time_t fTaken;
 
 	static AlbumItem* EqRef(AlbumItem *item, void *param);
 	static int CmpRef(const AlbumItem *a, const AlbumItem *b);
@@ -36,6 +40,8 @@ class AlbumFileItem : public AlbumItem {
 	static int CmpSize(const AlbumItem *a, const AlbumItem *b);
 	static int CmpCTime(const AlbumItem *a, const AlbumItem *b);
 	static int CmpMTime(const AlbumItem *a, const AlbumItem *b);
+	static int CmpTaken(const AlbumItem *a, const AlbumItem *b);
+	static int CmpPixels(const AlbumItem *a, const AlbumItem *b);
 	static int CmpDir(const AlbumItem *a, const AlbumItem *b);
 
 	AlbumFileItem(BRect frame, BBitmap *bitmap);
@@ -55,8 +61,17 @@ class AlbumFileItem : public AlbumItem {
 };
 
 
+/// MainView item index entry
+struct item_ref {
+	entry_ref ref;
+	AlbumFileItem *item;
+};
+
+
 enum {
-	CMD_ITEM_LAUNCH = 'iOpn'
+	CMD_ITEM_LAUNCH = 'iOpn',
+	MSG_VIEWPORT_CHANGED = 'vpCh',
+	MSG_SELECTION_CHANGED = 'slCh'
 };
 
 class MainView : public AlbumView
@@ -70,7 +85,14 @@ class MainView : public AlbumView
 	virtual void MouseDown(BPoint where);
 	virtual void Pulse();
 	virtual bool IsItemVisible(AlbumItem *item);
+	virtual void Arrange(bool invalidate = true);
 	virtual void SortItems();
+	virtual AlbumItem* AddItem(AlbumItem *item, int32 index = -1);
+	virtual AlbumItem* RemoveItem(int32 index);
+	virtual void DeleteSelected();
+	virtual void SelectionChanged();
+	AlbumFileItem* FindItem(const entry_ref &ref);
+	void SetItemRef(AlbumFileItem *item, entry_ref &ref);
 	int32 GetSelectedRefs(BMessage *message);
 	
 	private:
@@ -78,9 +100,18 @@ class MainView : public AlbumView
 	void LaunchItem(BMessage *message);
 	void ShowContextMenu(AlbumFileItem* item, BPoint where);
 	void ItemDragged(int32 index, BPoint where);
+	void CheckViewport();
+	void RebuildIndex();
 
 	BString fNoDataMsg;
 	BLocker fSelectLock;
+	BRect fViewport;
+	int32 fViewportCount;
+	bool fScrollUp;
+	// Items by entry_ref, for the loader updates.
+	BObjectList<item_ref> fIndex;
+	// Items that asked for details
+	BObjectList<entry_ref> fDetailed;
 
 };
 
@@ -12,11 +12,13 @@
 #include <NodeMonitor.h>
 #include <Clipboard.h>
 #include <Roster.h>
+#include <math.h>
 #include "MainWindow.h"
 #include "SplitView.h"
 #include "FileAttrDialog.h"
 #include "App.h"
 #include "JpegTagExtractor.h"
+#include "IconCache.h"
 
 #ifndef __HAIKU__
 #define B_SYSTEM_TEMP_DIRECTORY B_COMMON_TEMP_DIRECTORY
@@ -74,6 +76,8 @@ MainWindow::MainWindow(BRect frame, const char *title):
     menuSort->AddItem(new BMenuItem(_("File Size"), new BMessage(CMD_SORT_SIZE)));
     menuSort->AddItem(new BMenuItem(_("First Created"), new BMessage(CMD_SORT_CTIME)));
     menuSort->AddItem(new BMenuItem(_("Last Modified"), new BMessage(CMD_SORT_MTIME)));
+    menuSort->AddItem(new BMenuItem(_("Date Taken"), new BMessage(CMD_SORT_TAKEN)));
+    menuSort->AddItem(new BMenuItem(_("Image Size"), new BMessage(CMD_SORT_PIXELS)));
     menuSort->AddItem(new BMenuItem(_("Folder"), new BMessage(CMD_SORT_DIR)));
 	menuSort->ItemAt(0)->SetMarked(true);
 	
@@ -154,7 +158,7 @@ MainWindow::MainWindow(BRect frame, const char *title):
 			node_ref nref;
 			fRepository.GetNodeRef(&nref);
 			// this should display newly created files
-			watch_node(&nref, B_WATCH_DIRECTORY, fLoader,fLoader);
+			fLoader->WatchDirectory(nref);
 		}
 	}
 
@@ -200,6 +204,7 @@ void MainWindow::MessageReceived(BMessage *message)
 			break;
 		case B_SELECT_ALL:
 			fBrowser->Select(0, fBrowser->CountItems());
+			fBrowser->SelectionChanged();
 			ItemSelected(NULL);
 			break;
 		case B_PASTE:
@@ -218,6 +223,15 @@ void MainWindow::MessageReceived(BMessage *message)
 		case MSG_LOADER_UPDATE:
 			UpdateReceived(message);
 			break;
+		case MSG_LOADER_BATCH:
+			BatchReceived(message);
+			break;
+		case MSG_VIEWPORT_CHANGED:
+			fLoader->SetViewport(message);
+			break;
+		case MSG_SELECTION_CHANGED:
+			fLoader->SetSelection(message);
+			break;
 		case MSG_TOOLBAR_ZOOM: {
 			int32 value;
 			message->FindInt32("be:value", &value);
@@ -275,6 +289,14 @@ void MainWindow::MessageReceived(BMessage *message)
 			fBrowser->SetOrderBy(AlbumFileItem::CmpDir);
 			fBrowser->Arrange();
 			break;
+		case CMD_SORT_TAKEN:
+			fBrowser->SetOrderBy(AlbumFileItem::CmpTaken);
+			fBrowser->Arrange();
+			break;
+		case CMD_SORT_PIXELS:
+			fBrowser->SetOrderBy(AlbumFileItem::CmpPixels);
+			fBrowser->Arrange();
+			break;
 		case CMD_COL_0:
 			fBrowser->SetColumns(0);
 			break;
@@ -363,6 +385,7 @@ void MainWindow::PrefsReceived(BMessage *message)
 			fThumbFormat = B_BMP_FORMAT;
 		else if (format == "TIFF")
 			fThumbFormat = B_TIFF_FORMAT;
+		fLoader->SetThumbnailFormat(fThumbFormat);
 	}
 
 	if (message->FindString("thumb_attr", &s) == B_OK) {
@@ -373,6 +396,10 @@ void MainWindow::PrefsReceived(BMessage *message)
 	int32 options;
 	if (message->FindInt32("load_options", &options) == B_OK) 
 		fLoader->SetLoadOptions(options);
+
+	int32 workers;
+	if (message->FindInt32("load_workers", &workers) == B_OK) 
+		fLoader->SetWorkerCount(workers);
 	
 	if (message->FindInt32("display_options", &options) == B_OK) {
 		fBrowser->SetBuffering(options & 1);
@@ -452,6 +479,7 @@ void MainWindow::RefsReceived(BMessage *message)
 	entry_ref ref;
 	for (int i = 0; message->FindRef("refs", i, &ref) == B_OK; i++)
 		msg.AddRef("refs", &ref);
+	msg.AddInt32("generation", fLoader->Generation());
 	fLoader->PostMessage(&msg, NULL, this);
 }
 
@@ -469,6 +497,12 @@ void MainWindow::NoticeReceived(BMessage *message)
 		case MSG_LOADER_UPDATE:
 			UpdateReceived(message);
 			break;
+		case MSG_LOADER_BATCH:
+			BatchReceived(message);
+			break;
+		case MSG_VIEWPORT_CHANGED:
+			fLoader->SetViewport(message);
+			break;
 		case MSG_LOADER_DONE:
 			fToolbar->UpdateProgress(1,0);
 			break;
@@ -488,6 +522,70 @@ void MainWindow::NoticeReceived(BMessage *message)
 	File info received.
 */
 void MainWindow::UpdateReceived(BMessage *message)
+{
+	uint32 changes = 0;
+	if (ApplyUpdate(message, &changes)) {
+		// reflow necessary
+		fBrowser->SortItems();
+		fBrowser->Arrange();
+	}
+	if (changes)
+		fSidebar->Update(changes);
+	UpdateProgress(message);
+	fToolbar->SetCounter(fBrowser->CountItems());
+}
+
+
+/**
+	A batch of file infos received.
+	The items are all updated first, then sorted and arranged just once.
+*/
+void MainWindow::BatchReceived(BMessage *message)
+{
+	BMessage update;
+	uint32 changes = 0;
+	bool reflow = false;
+	for (int32 i = 0; message->FindMessage("update", i, &update) == B_OK; i++) {
+		reflow |= ApplyUpdate(&update, &changes);
+		// the latest one tells the progress
+		UpdateProgress(&update);
+	}
+	if (reflow) {
+		fBrowser->SortItems();
+		fBrowser->Arrange();
+	}
+	if (changes)
+		fSidebar->Update(changes);
+	fToolbar->SetCounter(fBrowser->CountItems());
+}
+
+
+/**
+	Copies all fields of 'from' into 'into', replacing those of the same name.
+*/
+static void merge_fields(BMessage *into, BMessage *from)
+{
+	char *name;
+	type_code type;
+	int32 count;
+	for (int32 i = 0; from->GetInfo(B_ANY_TYPE, i, &name, &type, &count) == B_OK; i++) {
+		into->RemoveName(name);
+		for (int32 j = 0; j < count; j++) {
+			const void *data;
+			ssize_t size;
+			if (from->FindData(name, type, j, &data, &size) == B_OK)
+				into->AddData(name, type, data, size, false);
+		}
+	}
+}
+
+
+/**
+	Applies a single file update.
+	Adds to 'pending' what the sidebar needs to refresh.
+	\returns true if items need to be sorted and arranged again.
+*/
+bool MainWindow::ApplyUpdate(BMessage *message, uint32 *pending)
 {
 	BBitmap *bitmap = NULL;
 	message->FindPointer("bitmap", (void**)&bitmap);
@@ -496,22 +594,31 @@ void MainWindow::UpdateReceived(BMessage *message)
 	if (message->FindRef("ref", &ref) != B_OK) {
 		// Like.. what?
 		PRINT(("Invalid item.\n"));
-		return;
+		IconCache::Release(bitmap);
+		return false;
 	}
 
 	bool redraw = false;
+	bool resort = false;
 	uint32 changes = 0;
 
-	AlbumFileItem *item = dynamic_cast<AlbumFileItem*>(fBrowser->EachItem(AlbumFileItem::EqRef, &ref));	
+	AlbumFileItem *item = fBrowser->FindItem(ref);
 	if (item) {
 		// Update an existing item
 		if (message->FindRef("newref", &ref) == B_OK) {
-			item->SetRef(ref);
+			fSidebar->InvalidateAttrs(item->Ref());
+			fBrowser->SetItemRef(item, ref);
 			// name changed
 			redraw = true;
 			changes |= UPDATE_STATS;
 		}
-		if (bitmap) {
+		int32 level;
+		if (bitmap && message->FindInt32("level", &level) == B_OK) {
+			// a sharper one for zooming in, same size on screen
+			item->SetDetail(level, bitmap);
+			fBrowser->InvalidateItem(item);
+		}
+		else if (bitmap) {
 			// invalidate the current rect
 			fBrowser->InvalidateItem(item);
 			// and change it...
@@ -520,10 +627,17 @@ void MainWindow::UpdateReceived(BMessage *message)
 			redraw = true;
 		}
 	}
+	else if (message->HasBool("update")) {
+		// Late news for an item that is gone already.
+		IconCache::Release(bitmap);
+		return false;
+	}
 	else {	
 		// create a new item with an impossible frame
 		item = new AlbumFileItem(BRect(-1,-1,0,0), bitmap);
 		item->SetRef(ref);
+		// placeholders come without a bitmap
+		item->SetPreviewSize(fThumbWidth, fThumbHeight);
 		item->SetHighlight(1.0);
 		if (fBrowser->AddItem(item)) {
 			redraw = true;
@@ -533,6 +647,9 @@ void MainWindow::UpdateReceived(BMessage *message)
 		}
 		changes |= UPDATE_STATS;		
 	}
+	// Icons have nothing to zoom into.
+	if (bitmap && !message->HasInt32("level"))
+		item->SetFlags(ALBUMITEM_ICON, message->HasBool("icon"));
 	
 	
 
@@ -563,18 +680,66 @@ void MainWindow::UpdateReceived(BMessage *message)
 	BMessage metadata;
 	if (message->FindMessage("tags", &metadata) == B_OK) {
 		item->fTags = metadata;
+		int16 width = item->fImgWidth, height = item->fImgHeight;
 		metadata.FindInt16("Width", &item->fImgWidth);
 		metadata.FindInt16("Height", &item->fImgHeight);
+		if (width != item->fImgWidth || height != item->fImgHeight)
+			resort = true;
 		changes |= UPDATE_TAGS;	
+		// tags are typed, no parsing needed
+		time_t taken = 0;
+		const time_t *time;
+		if (metadata.FindData("EXIF:DateTimeOriginal", B_TIME_TYPE, (const void**)&time, &size) == B_OK
+			|| metadata.FindData("EXIF:DateTimeDigitized", B_TIME_TYPE, (const void**)&time, &size) == B_OK
+			|| metadata.FindData("EXIF:DateTime", B_TIME_TYPE, (const void**)&time, &size) == B_OK)
+			taken = *time;
+		if (taken != item->fTaken)
+			resort = true;
+		item->fTaken = taken;
+		if (!item->Bitmap() && item->fImgWidth > 0 && item->fImgHeight > 0) {
+			// Placeholder the size the thumbnail will be.
+			float w = fThumbWidth, h = fThumbHeight;
+			if (item->fImgHeight * w / item->fImgWidth > h)
+				w = ceil(item->fImgWidth * h / item->fImgHeight);
+			else
+				h = ceil(item->fImgHeight * w / item->fImgWidth);
+			item->SetPreviewSize(w, h);
+		}
 	}
 
-	// BFS Attributes
-	if (message->FindMessage("attributes", &metadata) == B_OK) {
-		item->fAttributes = metadata;
+	// BFS Attributes, all of them or just those that changed.
+	// Only small values come along, the sidebar reads the rest.
+	bool attributes = false;
+	if (message->HasMessage("attributes") || message->HasMessage("attr_info")) {
+		item->fAttributes.MakeEmpty();
+		message->FindMessage("attributes", &item->fAttributes);
+		item->fAttrInfo.MakeEmpty();
+		message->FindMessage("attr_info", &item->fAttrInfo);
+		attributes = true;
+	}
+	if (message->FindMessage("changed_attr_info", &metadata) == B_OK) {
+		// replaced values may have grown too big to come along
+		char *attrname;
+		type_code type;
+		for (int32 i = 0; metadata.GetInfo(B_ANY_TYPE, i, &attrname, &type) == B_OK; i++)
+			item->fAttributes.RemoveName(attrname);
+		merge_fields(&item->fAttrInfo, &metadata);
+		attributes = true;
+	}
+	if (message->FindMessage("changed_attributes", &metadata) == B_OK)
+		merge_fields(&item->fAttributes, &metadata);
+	const char *removed;
+	for (int32 i = 0; message->FindString("removed_attributes", i, &removed) == B_OK; i++) {
+		item->fAttributes.RemoveName(removed);
+		item->fAttrInfo.RemoveName(removed);
+		attributes = true;
+	}
+	if (attributes) {
+		fSidebar->InvalidateAttrs(item->Ref());
 		// counting on non-BFS volume not getting this part at all...
 		bool marked = false;
 		uint32 oldflags = item->Flags();
-		item->SetFlags(ITEM_FLAG_MARKED, (metadata.FindBool("Marked", &marked) == B_OK) && marked);
+		item->SetFlags(ITEM_FLAG_MARKED, (item->fAttributes.FindBool("Marked", &marked) == B_OK) && marked);
 		redraw = oldflags != item->Flags();
 		changes |= UPDATE_ATTRS;	
 	}
@@ -591,28 +756,28 @@ void MainWindow::UpdateReceived(BMessage *message)
 	BRect r = item->Frame();
 	item->SetFlags((item->Flags() & 0xffff) | fLabelMask);
 	item->Update(fBrowser);
-	if (r != item->Frame() || (changes & UPDATE_STATS)) {
-		// reflow necessary
-		fBrowser->SortItems();
-		fBrowser->Arrange();
-	}
 
 	if(redraw) {
 		fBrowser->InvalidateItem(item);
 	}
 	
 	if (item->IsSelected())
-		fSidebar->Update(changes);
+		*pending |= changes;
 
-	// Progress Bar
+	return r != item->Frame() || (changes & UPDATE_STATS) || resort;
+}
+
+
+/**
+	Progress Bar
+*/
+void MainWindow::UpdateProgress(BMessage *message)
+{
 	int32 total = 0, done = 0;
 	if (message->FindInt32("total", &total) == B_OK) {
 		message->FindInt32("done", &done);
 		fToolbar->UpdateProgress(total, done);
 	}
-	
-	fToolbar->SetCounter(fBrowser->CountItems());
-
 }
 
 
@@ -620,17 +785,22 @@ void MainWindow::UpdateReceived(BMessage *message)
 
 
 /**
-	A file disappeared from the volume.
+	Files disappeared from the volume, or were never loaded.
 */
 void MainWindow::DeleteReceived(BMessage *message)
 {
 	entry_ref ref;
-	message->FindRef("ref", &ref);
-	AlbumItem *item = fBrowser->EachItem(AlbumFileItem::EqRef, &ref);
-	if (item) {
-		bool selected = item->IsSelected();
-		fBrowser->InvalidateItem(item);
-		delete fBrowser->RemoveItem(fBrowser->IndexOf(item));
+	bool removed = false, selected = false;
+	for (int i = 0; message->FindRef("ref", i, &ref) == B_OK; i++) {
+		AlbumItem *item = fBrowser->FindItem(ref);
+		if (item) {
+			selected |= item->IsSelected();
+			fBrowser->InvalidateItem(item);
+			delete fBrowser->RemoveItem(fBrowser->IndexOf(item));
+			removed = true;
+		}
+	}
+	if (removed) {
 		fBrowser->Arrange();
 		if (selected)
 			fSidebar->Update();
@@ -807,7 +977,9 @@ void MainWindow::CopySelectedTags()
 		for (int i = 0; tags.GetInfo(B_ANY_TYPE, i, &name, &type) == B_OK; i++) {
 			const void *data;
 			ssize_t size;
-			if (item->fTags.FindData(name, type, &data, &size) == B_OK)
+			// the selection has display strings, copy the stored type
+			if (item->fTags.GetInfo(name, &type) == B_OK
+				&& item->fTags.FindData(name, type, &data, &size) == B_OK)
 				node.WriteAttr(name, type, 0, data, size);
 		}
 	}
@@ -975,8 +1147,10 @@ void MainWindow::PasteFromClipboard()
 				if (clip->FindRef(name,&ref) == B_OK)
 					msg.AddRef("refs", &ref);
 			}
-			if (!msg.IsEmpty())
-				fLoader->PostMessage(&msg, NULL, this);			
+			if (!msg.IsEmpty()) {
+				msg.AddInt32("generation", fLoader->Generation());
+				fLoader->PostMessage(&msg, NULL, this);
+			}			
 		}
 		be_clipboard->Unlock();
  	}	
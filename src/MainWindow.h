@@ -26,6 +26,8 @@ enum {
 	CMD_SORT_MTIME = 'ord3',
 	CMD_SORT_SIZE = 'ord4',
 	CMD_SORT_DIR = 'ord5',
+	CMD_SORT_TAKEN = 'ord6',
+	CMD_SORT_PIXELS = 'ord7',
 	CMD_COL_0 = 'vc00',
 	CMD_COL_5 = 'vc05',
 	CMD_COL_10 = 'vc10',
@@ -64,6 +66,9 @@ class MainWindow : public BWindow
 	void RefsReceived(BMessage *message);
 	void NoticeReceived(BMessage *message);
 	void UpdateReceived(BMessage *message);
+	void BatchReceived(BMessage *message);
+	bool ApplyUpdate(BMessage *message, uint32 *pending);
+	void UpdateProgress(BMessage *message);
 	void DeleteReceived(BMessage *message);
 	void ItemSelected(BMessage *message);
 	void ItemRenamed(BMessage *message);
@@ -26,6 +26,7 @@ SOFTWARE.
 
 #include <NameValueItem.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include "App.h"
 #include "SettingsWindow.h"
 #include "ImageLoader.h"
@@ -87,6 +88,24 @@ SettingsWindow::SettingsWindow(BRect frame, const char *title):
     root->AddChild(menuField);
 	
 
+    // Decoder threads
+    fWorkersMenu = new BPopUpMenu(_("Auto"));
+    fWorkersMenu->AddItem(new BMenuItem(_("Auto"), NULL));
+    fWorkersMenu->AddItem(new BMenuItem("1", NULL));
+    fWorkersMenu->AddItem(new BMenuItem("2", NULL));
+    fWorkersMenu->AddItem(new BMenuItem("4", NULL));
+    fWorkersMenu->AddItem(new BMenuItem("8", NULL));
+    fWorkersMenu->SetTargetForItems(this);
+    fWorkersMenu->ResizeToPreferred();
+    b.OffsetBy(0, h);
+	menuField = new BMenuField(b, NULL, _("Decoding threads"), fWorkersMenu);
+#ifdef __HAIKU__    
+	menuField->SetToolTip(S_WORKERS_TIP);
+#endif
+	menuField->SetDivider(root->StringWidth(menuField->Label()) + 8);
+	menuField->ResizeToPreferred();
+    root->AddChild(menuField);
+
 	// Extract Tags
 	b.OffsetBy(0, h);
     fExtractTags = new BCheckBox(b, NULL, _("Read JPEG metadata"), new BMessage(MSG_EXTRACTTAGS_CHECK));
@@ -111,6 +130,22 @@ SettingsWindow::SettingsWindow(BRect frame, const char *title):
     fOnlyImages->ResizeToPreferred();
 	root->AddChild(fOnlyImages);
 
+	b.OffsetBy(0, h);
+    fWatchDirs = new BCheckBox(b, NULL, _("Watch folders only"), NULL);
+    fWatchDirs->ResizeToPreferred();
+#ifdef __HAIKU__    
+    fWatchDirs->SetToolTip(S_WATCHDIRS_TIP);
+#endif
+	root->AddChild(fWatchDirs);
+
+	b.OffsetBy(0, h);
+    fWriteThumbs = new BCheckBox(b, NULL, _("Write thumbnail attributes"), NULL);
+    fWriteThumbs->ResizeToPreferred();
+#ifdef __HAIKU__    
+    fWriteThumbs->SetToolTip(S_WRITETHUMBS_TIP);
+#endif
+	root->AddChild(fWriteThumbs);
+
 	// Display Options
 	b.OffsetBy(0, h);
     fAntiFlicker = new BCheckBox(b, NULL, _("Reduce flickering"), NULL);
@@ -213,8 +248,23 @@ void SettingsWindow::Restore(BMessage *message)
         	fReloadExisting->SetValue(1);
 		if (options & LOADER_ONLY_IMAGES)
         	fOnlyImages->SetValue(1);
+		if (options & LOADER_WATCH_DIRECTORIES)
+        	fWatchDirs->SetValue(1);
+		if (options & LOADER_WRITE_THUMBNAILS)
+        	fWriteThumbs->SetValue(1);
     }
 	fExifThumb->SetEnabled(fExtractTags->Value() == 1);
+
+    // Decoder threads, 0 is automatic.
+    int32 workers;
+    if (message->FindInt32("load_workers", &workers) == B_OK) {
+		BMenuItem *item = fWorkersMenu->ItemAt(0);
+		char s[16];
+		sprintf(s, "%ld", (long)workers);
+		if (workers > 0 && fWorkersMenu->FindItem(s))
+			item = fWorkersMenu->FindItem(s);
+		item->SetMarked(true);
+    }
 	
     if (message->FindInt32("display_options", &options) == B_OK) {
 		if (options & 1)
@@ -264,8 +314,18 @@ void SettingsWindow::Save()
 		options |= LOADER_RELOAD_EXISTING;
 	if (fOnlyImages->Value())
 		options |= LOADER_ONLY_IMAGES;
+	if (fWatchDirs->Value())
+		options |= LOADER_WATCH_DIRECTORIES;
+	if (fWriteThumbs->Value())
+		options |= LOADER_WRITE_THUMBNAILS;
 	msg.AddInt32("load_options", options);
 
+	// Decoder threads
+	int32 workers = 0;
+	if ((marked = fWorkersMenu->FindMarked()) && fWorkersMenu->IndexOf(marked) > 0)
+		workers = atoi(marked->Label());
+	msg.AddInt32("load_workers", workers);
+
 	options = fAntiFlicker->Value();
 	msg.AddInt32("display_options", options);
 
@@ -32,10 +32,13 @@ class SettingsWindow : public BWindow
     BTextControl *fReadAttr;
     BPopUpMenu *fSizeMenu;
     BPopUpMenu *fFormatMenu;
+    BPopUpMenu *fWorkersMenu;
     BCheckBox *fExtractTags;
     BCheckBox *fExifThumb;
     BCheckBox *fReloadExisting;
     BCheckBox *fOnlyImages;
+    BCheckBox *fWatchDirs;
+    BCheckBox *fWriteThumbs;
     BCheckBox *fAntiFlicker;
 };
 
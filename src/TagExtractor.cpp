@@ -23,17 +23,46 @@ SOFTWARE.
 */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <TagExtractor.h>
 
 
 TagExtractor::TagExtractor(BPositionIO *posio):
+    fTags(NULL),
     fPosIO(posio),
-    fTags(NULL)
+    fBuffer(NULL),
+    fStart(0),
+    fLength(0),
+    fPos(0),
+    fSpill(NULL)
 {
+	if (fPosIO)
+		fPos = fPosIO->Position();
 }
 
 TagExtractor::~TagExtractor()
 {
+	free(fBuffer);
+	free(fSpill);
+}
+
+
+/**
+	Buffers a block starting at 'pos'.
+	Returns the number of bytes available.
+*/
+ssize_t TagExtractor::Fill(off_t pos)
+{
+	if (!fBuffer)
+		fBuffer = (uint8*)malloc(TAGEXTRACTOR_BUFFER_SIZE);
+	if (!fBuffer || !fPosIO)
+		return 0;
+	fStart = pos;
+	fLength = fPosIO->ReadAt(pos, fBuffer, TAGEXTRACTOR_BUFFER_SIZE);
+	if (fLength < 0)
+		fLength = 0;
+	return fLength;
 }
 
 
@@ -42,30 +71,78 @@ TagExtractor::~TagExtractor()
 */
 int TagExtractor::Read()
 {
-	if (fPosIO) {
-        int c = 0;
-        if (fPosIO->Read(&c, 1) > 0)
-        	return c;
-    }
-    return EOF;
+	if (fPos < fStart || fPos >= fStart + fLength) {
+		if (Fill(fPos) <= 0)
+			return EOF;
+	}
+	return fBuffer[fPos++ - fStart];
 }
 
 
 /**
 	Implements file read.
-	Must perform a dummy read or seek if buf == NULL. 
+	Performs a dummy read (a skip) if buf == NULL. 
+	Only reads past the buffer go to the file, big ones directly.
 */
 int TagExtractor::Read(void *buf, int size)
 {
-	if (fPosIO) {
-        if (buf)
-            // read block
-            return fPosIO->Read(buf, size);
-        else
-            // skip
-            return fPosIO->Seek(size, SEEK_CUR);
-    }
-    return 0;
+	if (size <= 0)
+		return 0;
+	if (!buf) {
+		fPos += size;
+		return size;
+	}
+	int done = 0;
+	while (done < size) {
+		if (fPos < fStart || fPos >= fStart + fLength) {
+			if (size - done >= TAGEXTRACTOR_BUFFER_SIZE) {
+				ssize_t n = fPosIO ? fPosIO->ReadAt(fPos, (uint8*)buf + done, size - done) : 0;
+				if (n > 0) {
+					fPos += n;
+					done += n;
+				}
+				break;
+			}
+			if (Fill(fPos) <= 0)
+				break;
+		}
+		int n = fStart + fLength - fPos;
+		if (n > size - done)
+			n = size - done;
+		memcpy((uint8*)buf + done, fBuffer + (fPos - fStart), n);
+		fPos += n;
+		done += n;
+	}
+	return done;
+}
+
+
+/**
+	Reads 'size' bytes without copying them out of the buffer.
+	The result stays valid until the next read, NULL if the file
+	is too short.
+*/
+const uint8* TagExtractor::ReadBlock(int size)
+{
+	if (size <= 0)
+		return NULL;
+	if (size <= TAGEXTRACTOR_BUFFER_SIZE) {
+		if (fPos < fStart || fPos + size > fStart + fLength)
+			Fill(fPos);
+		if (fPos + size > fStart + fLength)
+			return NULL;
+		const uint8 *block = fBuffer + (fPos - fStart);
+		fPos += size;
+		return block;
+	}
+	uint8 *spill = (uint8*)realloc(fSpill, size);
+	if (!spill)
+		return NULL;
+	fSpill = spill;
+	if (!fPosIO || fPosIO->ReadAt(fPos, fSpill, size) != size)
+		return NULL;
+	fPos += size;
+	return fSpill;
 }
 
 
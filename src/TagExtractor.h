@@ -4,6 +4,13 @@
 #include <DataIO.h>
 #include <Message.h>
 
+// The file header is read in blocks of this size.
+#define TAGEXTRACTOR_BUFFER_SIZE (128 * 1024)
+
+/**
+	Base class for metadata readers.
+	Reads are buffered, subclasses can scan byte by byte at no cost.
+*/
 class TagExtractor
 {
     public:
@@ -13,13 +20,27 @@ class TagExtractor
 
     virtual int Read();
     virtual int Read(void *buf, int size);
+    const uint8* ReadBlock(int size);
     virtual void TagExtracted(int category, int id, const char *name, int type, void *value, int size);
     virtual status_t Extract(BMessage *tags, uint32 *features = NULL);
 
+    protected:
+
+	// set by Extract()
+	BMessage *fTags;
+
     private:
+
+	ssize_t Fill(off_t pos);
     
 	BPositionIO *fPosIO;
-	BMessage *fTags;
+	// fBuffer holds fLength bytes from fStart on, fPos is the read position.
+	uint8 *fBuffer;
+	off_t fStart;
+	ssize_t fLength;
+	off_t fPos;
+	// blocks too big for fBuffer
+	uint8 *fSpill;
 };
 
 #endif
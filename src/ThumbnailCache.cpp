@@ -0,0 +1,620 @@
+/**
+\file ThumbnailCache.cpp
+\brief Persistent thumbnail store
+
+A single file in the user settings directory keeps scaled bitmaps and
+the tags extracted along with them, so images need not be decoded again
+on the next launch. Records are keyed by device/inode and thumbnail
+size, and only count as valid while the file size, modification time,
+thumbnail size and load options all match. The levels of a thumbnail
+pyramid are kept in a cache file of their own, so they cannot push the
+thumbnails out.
+
+Layout: a header, a fixed open-addressing index of THUMBCACHE_SLOTS
+entries (node, size -> record offset) and then the records, appended one after
+another. Replaced records are abandoned where they are. Each slot notes
+when its record was last used; when the index fills up or the file
+reaches its size limit, Compact() copies the records used most recently
+to a new file, up to half the limit, and leaves the rest behind.
+Everything is in host byte order, the file is not meant to be moved
+between machines.
+
+Files nothing could decode get a record without a bitmap. Whether a
+file decodes does not depend on the thumbnail size, so there is only
+one such record per file, in the slot of box 0, and it is looked up
+before the slot of the requested size.
+
+On Haiku the file is memory mapped when opened, so reading the records
+already present at launch costs no system calls. Records appended later
+are read with ReadAt().
+*/
+
+#define DEBUG 1
+#include <Debug.h>
+#include <Autolock.h>
+#include <Entry.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __HAIKU__
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+#include "ThumbnailCache.h"
+#include "ObjectList.h"
+
+#define THUMBCACHE_MAGIC 'AThC'
+// 2: typed tags, 3: header tags of all formats, 4: slots per size,
+// 5: one failure record per file, 6: use stamps, 7: fingerprints
+#define THUMBCACHE_VERSION 7
+
+struct cache_header {
+	uint32 magic;
+	uint32 version;
+	uint32 slots;
+	uint32 count;
+	int64 end;
+	// the last use stamp handed out
+	uint32 clock;
+	uint32 reserved;
+};
+
+struct cache_slot {
+	int64 node;
+	int64 offset;
+	int32 device;
+	// the larger side of the thumbnail size, 0 for failure records
+	int32 box;
+	// of the record and the data that follows it
+	uint32 length;
+	// the clock when the record was last stored or found
+	uint32 used;
+};
+
+struct cache_record {
+	int64 node;
+	int64 size;
+	int64 mtime;
+	int32 device;
+	uint32 options;
+	float thumbWidth, thumbHeight;
+	uint32 flags;
+	uint32 colorSpace;
+	int32 width, height;
+	int32 bytesPerRow;
+	uint32 bitsLength;
+	uint32 tagsLength;
+	// no bitmap, the file could not be decoded
+	uint32 failed;
+	// of the file content, 0 if unknown
+	uint32 fingerprint;
+	uint32 reserved;
+};
+
+/// Thumbnail sizes that differ in their larger side get a slot each.
+static inline int32 key_box(const thumb_key &key)
+{
+	return (int32)(key.width > key.height ? key.width : key.height);
+}
+
+#define THUMBCACHE_INDEX_SIZE ((off_t)THUMBCACHE_SLOTS * sizeof(cache_slot))
+#define THUMBCACHE_DATA_START ((off_t)sizeof(cache_header) + THUMBCACHE_INDEX_SIZE)
+
+
+/**
+	Finds the slot for 'node' and 'box' in 'slots', or the empty slot
+	where it belongs. Linear probing; the index is never allowed to fill up.
+*/
+static int32 find_slot(const cache_slot *slots, const node_ref &node, int32 box)
+{
+	uint64 hash = ((uint64)node.node ^ ((uint64)node.device << 48) ^ ((uint64)box << 32))
+		* 0x9E3779B97F4A7C15ULL;
+	uint32 mask = THUMBCACHE_SLOTS - 1;
+	uint32 i = (uint32)(hash >> 32) & mask;
+	while (slots[i].offset != 0
+		&& (slots[i].node != node.node || slots[i].device != node.device
+			|| slots[i].box != box))
+		i = (i + 1) & mask;
+	return i;
+}
+
+
+/// Most recently used first
+static int cmp_used(const cache_slot *a, const cache_slot *b)
+{
+	// Stamps are compared as a difference, so they may wrap around.
+	return (int32)(b->used - a->used);
+}
+
+
+ThumbnailCache::ThumbnailCache():
+	fLock("ThumbnailCache"),
+	fSlots(NULL),
+	fCount(0),
+	fEnd(0),
+	fLimit(THUMBCACHE_SIZE_LIMIT),
+	fClock(0),
+	fIndexDirty(false),
+	fMap(NULL),
+	fMapSize(0)
+{
+}
+
+
+ThumbnailCache::~ThumbnailCache()
+{
+	Close();
+}
+
+
+/**
+	Opens or creates the cache file, which is kept below 'limit' bytes.
+	An unusable file is silently started over.
+*/
+status_t ThumbnailCache::Open(const char *path, off_t limit)
+{
+	BAutolock lock(fLock);
+	Close();
+	fPath = path;
+	fLimit = limit;
+	status_t status = fFile.SetTo(path, B_READ_WRITE | B_CREATE_FILE);
+	if (status != B_OK)
+		return status;
+
+	fSlots = (cache_slot*)calloc(THUMBCACHE_SLOTS, sizeof(cache_slot));
+	if (!fSlots)
+		return B_NO_MEMORY;
+
+	cache_header header;
+	off_t size = 0;
+	fFile.GetSize(&size);
+	if (fFile.ReadAt(0, &header, sizeof(header)) != sizeof(header)
+		|| header.magic != THUMBCACHE_MAGIC
+		|| header.version != THUMBCACHE_VERSION
+		|| header.slots != THUMBCACHE_SLOTS
+		|| header.end < THUMBCACHE_DATA_START || header.end > size
+		|| fFile.ReadAt(sizeof(header), fSlots, THUMBCACHE_INDEX_SIZE) != THUMBCACHE_INDEX_SIZE)
+		return Reset();
+
+	fCount = header.count;
+	fEnd = header.end;
+	fClock = header.clock;
+	Map();
+	PRINT(("ThumbnailCache: %ld records, %Ld bytes.\n", fCount, fEnd));
+	return B_OK;
+}
+
+
+/**
+	Closes the file, after saving the use stamps of the records found.
+*/
+void ThumbnailCache::Close()
+{
+	BAutolock lock(fLock);
+	if (fSlots && fIndexDirty)
+		WriteIndex(&fFile, fSlots);
+	fIndexDirty = false;
+	Unmap();
+	free(fSlots);
+	fSlots = NULL;
+	fFile.Unset();
+}
+
+
+status_t ThumbnailCache::InitCheck()
+{
+	return fSlots ? B_OK : B_NO_INIT;
+}
+
+
+/**
+	Looks up a thumbnail.
+	Returns a new bitmap (owned by the caller) and fills in 'tags' and 'flags',
+	or NULL if there is no valid record for 'key'. If the file is known
+	not to decode, 'failed' is set and 'tags' and 'flags' are filled in
+	all the same. 'fingerprint' gets the one stored with the thumbnail.
+*/
+BBitmap* ThumbnailCache::Find(const thumb_key &key, BMessage *tags, uint32 *flags, bool *failed,
+	uint32 *fingerprint)
+{
+	if (failed)
+		*failed = false;
+	if (fingerprint)
+		*fingerprint = 0;
+	BAutolock lock(fLock);
+	cache_record rec;
+	off_t pos = Lookup(key, &rec);
+	if (pos == 0)
+		return NULL;
+
+	if (rec.failed) {
+		if (tags && rec.tagsLength > 0)
+			ReadTags(pos, rec.tagsLength, tags);
+		if (flags)
+			*flags = rec.flags;
+		if (failed)
+			*failed = true;
+		return NULL;
+	}
+
+	BBitmap *bitmap = new BBitmap(BRect(0, 0, rec.width - 1, rec.height - 1), (color_space)rec.colorSpace);
+	if (bitmap->InitCheck() != B_OK || bitmap->BytesPerRow() != rec.bytesPerRow
+		|| (uint32)bitmap->BitsLength() != rec.bitsLength
+		|| ReadAt(pos, bitmap->Bits(), rec.bitsLength) != (ssize_t)rec.bitsLength) {
+		delete bitmap;
+		return NULL;
+	}
+	pos += rec.bitsLength;
+
+	if (tags && rec.tagsLength > 0)
+		ReadTags(pos, rec.tagsLength, tags);
+	if (flags)
+		*flags = rec.flags;
+	if (fingerprint)
+		*fingerprint = rec.fingerprint;
+	return bitmap;
+}
+
+
+/**
+	Tells whether there is a thumbnail for 'key', without reading it.
+	Records of files that could not be decoded do not count.
+*/
+bool ThumbnailCache::Contains(const thumb_key &key)
+{
+	BAutolock lock(fLock);
+	cache_record rec;
+	return Lookup(key, &rec) != 0 && !rec.failed;
+}
+
+
+/**
+	Tells whether the file of 'key' is known not to decode.
+*/
+bool ThumbnailCache::Failed(const thumb_key &key)
+{
+	BAutolock lock(fLock);
+	cache_record rec;
+	return Lookup(key, &rec) != 0 && rec.failed;
+}
+
+
+/**
+	Reads the record for 'key' into 'rec', if there is a valid one.
+	A failure record of the file is valid for any thumbnail size.
+	Returns the position of the data that follows it, or 0.
+	The caller holds the lock.
+*/
+off_t ThumbnailCache::Lookup(const thumb_key &key, cache_record *rec)
+{
+	if (!fSlots)
+		return 0;
+	int32 i = SlotFor(key.node, 0);
+	off_t pos = ReadRecord(key, i, rec);
+	if (pos == 0 || !rec->failed) {
+		i = SlotFor(key.node, key_box(key));
+		pos = ReadRecord(key, i, rec);
+		if (pos == 0 || rec->failed
+			|| rec->thumbWidth != key.width || rec->thumbHeight != key.height)
+			return 0;
+	}
+	fSlots[i].used = ++fClock;
+	fIndexDirty = true;
+	return pos;
+}
+
+
+/**
+	Reads the record of slot 'i' into 'rec', if it is one of the same
+	file, unchanged, loaded with the same options.
+	Returns the position of the data that follows it, or 0.
+	\warning fLock must be held.
+*/
+off_t ThumbnailCache::ReadRecord(const thumb_key &key, int32 i, cache_record *rec)
+{
+	if (fSlots[i].offset == 0)
+		return 0;
+
+	off_t pos = fSlots[i].offset;
+	if (ReadAt(pos, rec, sizeof(*rec)) != sizeof(*rec))
+		return 0;
+	if (rec->node != key.node.node || rec->device != key.node.device
+		|| rec->size != key.size || rec->mtime != key.mtime
+		|| rec->options != key.options)
+		return 0;
+	return pos + sizeof(*rec);
+}
+
+
+/**
+	Adds or replaces the thumbnail for 'key'.
+	A NULL 'bitmap' records that the file could not be decoded, at any size.
+	'fingerprint' is the content fingerprint of the file, if known.
+*/
+status_t ThumbnailCache::Store(const thumb_key &key, const BBitmap *bitmap, const BMessage *tags, uint32 flags,
+	uint32 fingerprint)
+{
+	cache_record rec;
+	memset(&rec, 0, sizeof(rec));
+	rec.node = key.node.node;
+	rec.device = key.node.device;
+	rec.size = key.size;
+	rec.mtime = key.mtime;
+	rec.thumbWidth = key.width;
+	rec.thumbHeight = key.height;
+	rec.options = key.options;
+	rec.flags = flags;
+	rec.fingerprint = fingerprint;
+	if (bitmap) {
+		rec.colorSpace = bitmap->ColorSpace();
+		rec.width = bitmap->Bounds().IntegerWidth() + 1;
+		rec.height = bitmap->Bounds().IntegerHeight() + 1;
+		rec.bytesPerRow = bitmap->BytesPerRow();
+		rec.bitsLength = bitmap->BitsLength();
+	}
+	else
+		rec.failed = 1;
+
+	// Flatten outside the lock.
+	char *flat = NULL;
+	if (tags && !tags->IsEmpty()) {
+		rec.tagsLength = tags->FlattenedSize();
+		flat = (char*)malloc(rec.tagsLength);
+		if (!flat || tags->Flatten(flat, rec.tagsLength) != B_OK)
+			rec.tagsLength = 0;
+	}
+	off_t length = sizeof(rec) + rec.bitsLength + rec.tagsLength;
+
+	BAutolock lock(fLock);
+	status_t status = fSlots ? B_OK : B_NO_INIT;
+	// Both give up the index if they cannot write the file.
+	if (status == B_OK && (fCount >= THUMBCACHE_SLOTS*3/4 || fEnd + length > fLimit))
+		status = Compact();
+	if (status == B_OK && fEnd + length > fLimit)
+		status = B_DEVICE_FULL;
+	if (status == B_OK) {
+		int32 box = bitmap ? key_box(key) : 0;
+		int32 i = SlotFor(key.node, box);
+		off_t pos = fEnd;
+		if (fFile.WriteAt(pos, &rec, sizeof(rec)) == sizeof(rec)
+			&& (rec.bitsLength == 0 || fFile.WriteAt(pos + sizeof(rec), bitmap->Bits(), rec.bitsLength) == (ssize_t)rec.bitsLength)
+			&& (rec.tagsLength == 0 || fFile.WriteAt(pos + sizeof(rec) + rec.bitsLength, flat, rec.tagsLength) == (ssize_t)rec.tagsLength)) {
+			if (fSlots[i].offset == 0)
+				fCount++;
+			fSlots[i].node = key.node.node;
+			fSlots[i].device = key.node.device;
+			fSlots[i].box = box;
+			fSlots[i].offset = pos;
+			fSlots[i].length = length;
+			fSlots[i].used = ++fClock;
+			fEnd += length;
+			// Index entry last, so a torn write never points at garbage.
+			fFile.WriteAt(sizeof(cache_header) + i*sizeof(cache_slot), &fSlots[i], sizeof(cache_slot));
+			WriteHeader(&fFile);
+			status = B_OK;
+		}
+		else
+			status = B_IO_ERROR;
+	}
+	free(flat);
+	return status;
+}
+
+
+/**
+	Starts over with an empty file.
+	\warning fLock must be held.
+*/
+status_t ThumbnailCache::Reset()
+{
+	PRINT(("ThumbnailCache: reset.\n"));
+	Unmap();
+	memset(fSlots, 0, THUMBCACHE_INDEX_SIZE);
+	fCount = 0;
+	fEnd = THUMBCACHE_DATA_START;
+	fIndexDirty = false;
+	status_t status = fFile.SetSize(0);
+	if (status == B_OK)
+		status = fFile.SetSize(fEnd);
+	if (status == B_OK)
+		status = WriteHeader(&fFile);
+	if (status != B_OK) {
+		free(fSlots);
+		fSlots = NULL;
+	}
+	return status;
+}
+
+
+/**
+	Makes room by copying the records used most recently to a new file,
+	up to half the size limit and half the slots, and replacing the old
+	file with it. Abandoned records and the ones not used for the
+	longest time are left behind. Starts over with Reset() if the copy
+	cannot be made.
+	\warning fLock must be held.
+*/
+status_t ThumbnailCache::Compact()
+{
+	BObjectList<cache_slot> used(fCount + 1, false);
+	for (int32 i = 0; i < THUMBCACHE_SLOTS; i++) {
+		if (fSlots[i].offset != 0)
+			used.AddItem(&fSlots[i]);
+	}
+	used.SortItems(cmp_used);
+
+	BString path(fPath);
+	path << "~";
+	BFile file;
+	cache_slot *slots = (cache_slot*)calloc(THUMBCACHE_SLOTS, sizeof(cache_slot));
+	status_t status = slots ? file.SetTo(path.String(), B_READ_WRITE | B_CREATE_FILE | B_ERASE_FILE) : B_NO_MEMORY;
+	uint32 count = 0;
+	off_t end = THUMBCACHE_DATA_START;
+	uint8 *buffer = NULL;
+	uint32 bufferSize = 0;
+	for (int32 k = 0; status == B_OK && k < used.CountItems(); k++) {
+		const cache_slot *slot = used.ItemAt(k);
+		if (count >= THUMBCACHE_SLOTS/2 || end + slot->length > fLimit/2)
+			break;
+		if (slot->length > bufferSize) {
+			free(buffer);
+			bufferSize = slot->length;
+			buffer = (uint8*)malloc(bufferSize);
+			if (!buffer) {
+				status = B_NO_MEMORY;
+				break;
+			}
+		}
+		if (ReadAt(slot->offset, buffer, slot->length) != (ssize_t)slot->length
+			|| file.WriteAt(end, buffer, slot->length) != (ssize_t)slot->length) {
+			status = B_IO_ERROR;
+			break;
+		}
+		node_ref node;
+		node.device = slot->device;
+		node.node = slot->node;
+		int32 i = find_slot(slots, node, slot->box);
+		slots[i] = *slot;
+		slots[i].offset = end;
+		end += slot->length;
+		count++;
+	}
+	free(buffer);
+
+	uint32 oldCount = fCount;
+	off_t oldEnd = fEnd;
+	if (status == B_OK) {
+		fCount = count;
+		fEnd = end;
+		status = WriteIndex(&file, slots);
+	}
+	if (status == B_OK)
+		status = BEntry(path.String()).Rename(fPath.String(), true);
+	if (status == B_OK) {
+		Unmap();
+		free(fSlots);
+		fSlots = slots;
+		fIndexDirty = false;
+		// The renamed file, the old one is gone.
+		status = fFile.SetTo(fPath.String(), B_READ_WRITE);
+		if (status == B_OK)
+			Map();
+		else {
+			free(fSlots);
+			fSlots = NULL;
+		}
+		PRINT(("ThumbnailCache: compacted to %ld records, %Ld bytes.\n", fCount, fEnd));
+		return status;
+	}
+
+	PRINT(("ThumbnailCache: compacting failed, %s.\n", strerror(status)));
+	free(slots);
+	fCount = oldCount;
+	fEnd = oldEnd;
+	file.Unset();
+	BEntry(path.String()).Remove();
+	return Reset();
+}
+
+
+/**
+	Writes the whole index of 'slots' and the header to 'file'.
+	\warning fLock must be held.
+*/
+status_t ThumbnailCache::WriteIndex(BFile *file, const cache_slot *slots)
+{
+	if (file->WriteAt(sizeof(cache_header), slots, THUMBCACHE_INDEX_SIZE) != THUMBCACHE_INDEX_SIZE)
+		return B_IO_ERROR;
+	return WriteHeader(file);
+}
+
+
+/**
+	\warning fLock must be held.
+*/
+status_t ThumbnailCache::WriteHeader(BFile *file)
+{
+	cache_header header;
+	memset(&header, 0, sizeof(header));
+	header.magic = THUMBCACHE_MAGIC;
+	header.version = THUMBCACHE_VERSION;
+	header.slots = THUMBCACHE_SLOTS;
+	header.count = fCount;
+	header.end = fEnd;
+	header.clock = fClock;
+	if (file->WriteAt(0, &header, sizeof(header)) != sizeof(header))
+		return B_IO_ERROR;
+	return B_OK;
+}
+
+
+/**
+	Maps the records present so far.
+	\warning fLock must be held.
+*/
+void ThumbnailCache::Map()
+{
+#ifdef __HAIKU__
+	int fd = open(fPath.String(), O_RDONLY);
+	if (fd < 0)
+		return;
+	void *map = mmap(NULL, fEnd, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map != MAP_FAILED) {
+		fMap = (const uint8*)map;
+		fMapSize = fEnd;
+	}
+#endif
+}
+
+
+/**
+	\warning fLock must be held.
+*/
+void ThumbnailCache::Unmap()
+{
+#ifdef __HAIKU__
+	if (fMap)
+		munmap((void*)fMap, fMapSize);
+#endif
+	fMap = NULL;
+	fMapSize = 0;
+}
+
+
+/**
+	Finds the index slot for 'node' and 'box', or the empty slot where
+	it belongs. Linear probing; the index is never allowed to fill up.
+	\warning fLock must be held.
+*/
+int32 ThumbnailCache::SlotFor(const node_ref &node, int32 box)
+{
+	return find_slot(fSlots, node, box);
+}
+
+
+/**
+	Unflattens the tags of a record.
+	\warning fLock must be held.
+*/
+void ThumbnailCache::ReadTags(off_t pos, uint32 length, BMessage *tags)
+{
+	char *buf = (char*)malloc(length);
+	if (buf && ReadAt(pos, buf, length) == (ssize_t)length)
+		tags->Unflatten(buf);
+	free(buf);
+}
+
+
+/**
+	Reads from the mapping if possible, from the file otherwise.
+	\warning fLock must be held.
+*/
+ssize_t ThumbnailCache::ReadAt(off_t pos, void *buffer, size_t size)
+{
+	if (fMap && pos + (off_t)size <= (off_t)fMapSize) {
+		memcpy(buffer, fMap + pos, size);
+		return size;
+	}
+	return fFile.ReadAt(pos, buffer, size);
+}
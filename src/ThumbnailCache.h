@@ -0,0 +1,73 @@
+#ifndef _THUMBNAILCACHE_H_
+#define _THUMBNAILCACHE_H_
+
+#include <Bitmap.h>
+#include <File.h>
+#include <Locker.h>
+#include <Message.h>
+#include <Node.h>
+#include <String.h>
+
+#define THUMBCACHE_FILE "Album_thumbnails"
+#define THUMBCACHE_DETAIL_FILE "Album_details"
+#define THUMBCACHE_SLOTS (1 << 17)
+// A 64x64 thumbnail and its tags take about 17KB, this fits 60000.
+#define THUMBCACHE_SIZE_LIMIT ((off_t)1024 * 1024 * 1024)
+// Zoomed in levels are many times bigger, only the recent ones are kept.
+#define THUMBCACHE_DETAIL_SIZE_LIMIT ((off_t)256 * 1024 * 1024)
+
+/// What a thumbnail was made of, a record is only valid for the same key.
+struct thumb_key {
+	node_ref node;
+	off_t size;
+	time_t mtime;
+	float width, height;
+	uint32 options;
+};
+
+
+class ThumbnailCache
+{
+	public:
+
+	ThumbnailCache();
+	~ThumbnailCache();
+	status_t Open(const char *path, off_t limit = THUMBCACHE_SIZE_LIMIT);
+	void Close();
+	status_t InitCheck();
+	BBitmap* Find(const thumb_key &key, BMessage *tags, uint32 *flags, bool *failed = NULL,
+		uint32 *fingerprint = NULL);
+	bool Contains(const thumb_key &key);
+	bool Failed(const thumb_key &key);
+	status_t Store(const thumb_key &key, const BBitmap *bitmap, const BMessage *tags, uint32 flags,
+		uint32 fingerprint = 0);
+
+	private:
+
+	status_t Reset();
+	status_t Compact();
+	status_t WriteIndex(BFile *file, const struct cache_slot *slots);
+	status_t WriteHeader(BFile *file);
+	void Map();
+	void Unmap();
+	int32 SlotFor(const node_ref &node, int32 box);
+	off_t Lookup(const thumb_key &key, struct cache_record *rec);
+	off_t ReadRecord(const thumb_key &key, int32 slot, struct cache_record *rec);
+	ssize_t ReadAt(off_t pos, void *buffer, size_t size);
+	void ReadTags(off_t pos, uint32 length, BMessage *tags);
+
+	BLocker fLock;
+	BFile fFile;
+	BString fPath;
+	struct cache_slot *fSlots;
+	uint32 fCount;
+	off_t fEnd;
+	off_t fLimit;
+	// use stamps of the records
+	uint32 fClock;
+	bool fIndexDirty;
+	const uint8 *fMap;
+	size_t fMapSize;
+};
+
+#endif
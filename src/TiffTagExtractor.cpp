@@ -0,0 +1,223 @@
+/**
+\file TiffTagExtractor.cpp
+\brief Embedded previews of TIFF based RAW files
+
+Camera RAW files are TIFF files holding the sensor data along with one
+or more JPEG renditions of it, a small thumbnail and usually a preview
+of a few megapixels, sometimes a full size one. The TranslationKit
+either cannot read the RAW data or takes seconds to develop it, while
+the previews decode about as fast as any JPEG.
+
+The IFDs all sit near the file start, so only that much is read and
+walked in place. The previews themselves are probed for their size by
+reading their JPEG headers, and only the chosen one is read in full.
+*/
+
+#include <Debug.h>
+#include <stdlib.h>
+#include <string.h>
+#include "TiffTagExtractor.h"
+#include "IfdWalker.h"
+
+
+TiffTagExtractor::TiffTagExtractor(BPositionIO *posio, float width, float height, bool preview):
+	JpegTagExtractor(posio, false),
+	fSource(posio),
+	fWidth(width),
+	fHeight(height),
+	fPreview(preview),
+	fHasExif(false),
+	fImageWidth(0),
+	fImageHeight(0),
+	fPreviewCount(0)
+{
+}
+
+
+/**
+	Checks the TIFF byte order mark.
+*/
+bool TiffTagExtractor::IsTiff(BPositionIO *posio)
+{
+	uint8 magic[4];
+	if (posio->ReadAt(0, magic, 4) != 4)
+		return false;
+	return (magic[0] == 'I' && magic[1] == 'I' && magic[2] == 42 && magic[3] == 0)
+		|| (magic[0] == 'M' && magic[1] == 'M' && magic[2] == 0 && magic[3] == 42);
+}
+
+
+/**
+	Extracts the EXIF tags and picks the preview.
+	\returns B_BAD_VALUE if not a TIFF file.
+	features: HAS_EXIF.
+*/
+status_t TiffTagExtractor::Extract(BMessage *tags, uint32 *features)
+{
+	TagExtractor::Extract(tags);
+	uint8 *head = (uint8*)malloc(TIFFTAGEXTRACTOR_HEAD_SIZE);
+	if (!head)
+		return B_NO_MEMORY;
+	ssize_t size = fSource->ReadAt(0, head, TIFFTAGEXTRACTOR_HEAD_SIZE);
+	bool bigEndian = false;
+	uint32 ifd0 = size > 0 ? tiff_header(head, size, &bigEndian) : 0;
+	if (!ifd0) {
+		free(head);
+		return B_BAD_VALUE;
+	}
+	if (bigEndian) {
+		ReadIFDs<tiff_big_endian>(head, size, ifd0);
+		FindPreviews<tiff_big_endian>(head, size, ifd0, 0);
+	}
+	else {
+		ReadIFDs<tiff_little_endian>(head, size, ifd0);
+		FindPreviews<tiff_little_endian>(head, size, ifd0, 0);
+	}
+	free(head);
+
+	if (fPreview)
+		ReadPreview();
+
+	if (fImageWidth > 0 && fImageHeight > 0) {
+		int16 width = fImageWidth < 0x7fff ? fImageWidth : 0x7fff;
+		int16 height = fImageHeight < 0x7fff ? fImageHeight : 0x7fff;
+		TagExtracted('TIFF', 2, "Width", B_INT16_TYPE, &width, 2);
+		TagExtracted('TIFF', 3, "Height", B_INT16_TYPE, &height, 2);
+	}
+	if (features)
+		*features = fHasExif ? HAS_EXIF : 0;
+	return B_OK;
+}
+
+
+/**
+	Collects JPEG images from an IFD chain and its sub-IFDs.
+*/
+template <class Order>
+void TiffTagExtractor::FindPreviews(const uint8 *tiff, uint32 size, uint32 ofs, int depth)
+{
+	// Next() only goes forward, so the chain ends.
+	while (ofs) {
+		IfdWalker<Order> ifd(tiff, size, ofs);
+		uint32 width = 0, height = 0, compression = 0;
+		uint32 strip = 0, stripLength = 0, jpeg = 0, jpegLength = 0;
+		for (int32 i = 0; i < ifd.CountEntries(); i++) {
+			IfdEntry<Order> entry = ifd.EntryAt(i);
+			switch (entry.Tag()) {
+				case EXIF_IMAGE_WIDTH:
+					width = entry.UInt();
+					break;
+				case EXIF_IMAGE_LENGTH:
+					height = entry.UInt();
+					break;
+				case EXIF_COMPRESSION:
+					compression = entry.UInt();
+					break;
+				case EXIF_STRIP_OFFSETS:
+					if (entry.Count() == 1)
+						strip = entry.UInt();
+					break;
+				case EXIF_STRIP_BYTE_COUNTS:
+					if (entry.Count() == 1)
+						stripLength = entry.UInt();
+					break;
+				case EXIF_JPEG_INTERCHANGE_FORMAT:
+					jpeg = entry.UInt();
+					break;
+				case EXIF_JPEG_INTERCHANGE_FORMAT_LENGTH:
+					jpegLength = entry.UInt();
+					break;
+				case EXIF_IFD_POINTER:
+					fHasExif = true;
+					break;
+				case EXIF_SUB_IFDS:
+					// DNG and NEF keep their previews there
+					if (depth < 2) {
+						for (uint32 j = 0; j < entry.Count() && j < 4; j++)
+							FindPreviews<Order>(tiff, size, entry.UInt(j), depth + 1);
+					}
+					break;
+			}
+		}
+		if ((uint64)width * height > (uint64)fImageWidth * fImageHeight) {
+			fImageWidth = width;
+			fImageHeight = height;
+		}
+		if (jpeg && jpegLength)
+			AddPreview(jpeg, jpegLength);
+		// JPEG compressed, in a single strip
+		if ((compression == 6 || compression == 7) && strip && stripLength)
+			AddPreview(strip, stripLength);
+		if (depth > 0)
+			break;
+		ofs = ifd.Next();
+	}
+}
+
+
+void TiffTagExtractor::AddPreview(uint32 offset, uint32 length)
+{
+	if (fPreviewCount >= TIFFTAGEXTRACTOR_MAX_PREVIEWS || length > TIFFTAGEXTRACTOR_MAX_PREVIEW)
+		return;
+	for (int32 i = 0; i < fPreviewCount; i++) {
+		if (fPreviews[i].offset == offset)
+			return;
+	}
+	fPreviews[fPreviewCount].offset = offset;
+	fPreviews[fPreviewCount].length = length;
+	fPreviewCount++;
+}
+
+
+/**
+	Reads the smallest preview at least as big as the thumbnail,
+	or the biggest one if none is.
+*/
+void TiffTagExtractor::ReadPreview()
+{
+	off_t fileSize;
+	if (fSource->GetSize(&fileSize) != B_OK)
+		return;
+	int32 best = -1;
+	bool bestCovers = false;
+	int64 bestArea = 0;
+	for (int32 i = 0; i < fPreviewCount; i++) {
+		const tiff_preview &preview = fPreviews[i];
+		if ((off_t)preview.offset + preview.length > fileSize)
+			continue;
+		int16 width, height;
+		uint8 sof;
+		// Lossless JPEG is RAW data, libjpeg only does baseline and progressive.
+		if (ReadSize(fSource, &width, &height, preview.offset, &sof) != B_OK
+			|| sof > 0xc2 || width <= 0 || height <= 0)
+			continue;
+		if ((int64)width * height > (int64)fImageWidth * fImageHeight) {
+			fImageWidth = width;
+			fImageHeight = height;
+		}
+		int64 area = (int64)width * height;
+		// fit to frame, one side is enough
+		bool covers = width >= fWidth || height >= fHeight;
+		if (best < 0 || (covers && (!bestCovers || area < bestArea))
+			|| (!covers && !bestCovers && area > bestArea)) {
+			best = i;
+			bestCovers = covers;
+			bestArea = area;
+		}
+	}
+	if (best < 0)
+		return;
+
+	const tiff_preview &preview = fPreviews[best];
+	void *data = malloc(preview.length);
+	if (!data)
+		return;
+	if (fSource->ReadAt(preview.offset, data, preview.length) != (ssize_t)preview.length) {
+		free(data);
+		return;
+	}
+	free(fThumbnailData);
+	fThumbnailData = data;
+	fThumbnailSize = preview.length;
+	PRINT(("TIFF preview: %lu bytes at %lu\n", preview.length, preview.offset));
+}
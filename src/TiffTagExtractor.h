@@ -0,0 +1,49 @@
+#ifndef _TIFFTAGEXTRACTOR_H_
+#define _TIFFTAGEXTRACTOR_H_
+
+#include <JpegTagExtractor.h>
+
+// IFDs are looked for in this many bytes from the file start.
+#define TIFFTAGEXTRACTOR_HEAD_SIZE (256 * 1024)
+// Bigger embedded images are not worth reading.
+#define TIFFTAGEXTRACTOR_MAX_PREVIEW (32 * 1024 * 1024)
+#define TIFFTAGEXTRACTOR_MAX_PREVIEWS 8
+
+/// An embedded JPEG image
+struct tiff_preview {
+	uint32 offset;
+	uint32 length;
+};
+
+/**
+	Extracts EXIF tags and the embedded JPEG preview of TIFF based files,
+	which most camera RAW formats (CR2, NEF, ARW, DNG, PEF) are.
+	Of the previews, the smallest one that still covers 'width' x 'height'
+	is kept. GetThumbnailData() returns it.
+*/
+class TiffTagExtractor: public JpegTagExtractor
+{
+    public:
+
+	TiffTagExtractor(BPositionIO *posio, float width, float height, bool preview = true);
+
+    virtual status_t Extract(BMessage *tags, uint32 *features = NULL);
+    static bool IsTiff(BPositionIO *posio);
+
+    private:
+
+    template <class Order>
+    void FindPreviews(const uint8 *tiff, uint32 size, uint32 ofs, int depth);
+    void AddPreview(uint32 offset, uint32 length);
+    void ReadPreview();
+
+    BPositionIO *fSource;
+    float fWidth, fHeight;
+    bool fPreview, fHasExif;
+    // largest image dimensions seen
+    int32 fImageWidth, fImageHeight;
+    tiff_preview fPreviews[TIFFTAGEXTRACTOR_MAX_PREVIEWS];
+    int32 fPreviewCount;
+};
+
+#endif
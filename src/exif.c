@@ -32,8 +32,12 @@ SOFTWARE.
 
 
 
+/*
+  Look-up tables are sorted by id for exif_descr().
+*/
+
 /* tag name look-up table */
-exif_description_t exif_tag_name[] = {
+static const exif_description_t exif_tag_name[] = {
   {   0x100,   "ImageWidth"},
   {   0x101,   "ImageHeight"},
   {   0x102,   "BitsPerSample"},
@@ -129,11 +133,10 @@ exif_description_t exif_tag_name[] = {
   {   0xA40B,  "DeviceSettingDescription"},
   {   0xA40C,  "SubjectDistanceRange"},
   {   0xA500,  "Gamma"},
-  {   -1, NULL}
 };
 
 /* Tag value lookup tables */
-static exif_description_t exif_orientation[] = {
+static const exif_description_t exif_orientation[] = {
 	{ 1,	"Top Left" },
 	{ 2,	"Top Right" },
 	{ 3,	"Bottom Right" },
@@ -142,32 +145,28 @@ static exif_description_t exif_orientation[] = {
 	{ 6,	"RightTop" },
 	{ 7,	"Right Bottom" },
 	{ 8,	"Left Bottom" },
-	{ -1, NULL}
 };
 
 
-static exif_description_t exif_planar_conf[] = {
+static const exif_description_t exif_planar_conf[] = {
 	{ 1,	"Chunky Format" },
 	{ 2, 	"Planar Format" },
-	{-1, NULL}
 };
 
 
-static exif_description_t exif_res_unit[] = {
+static const exif_description_t exif_res_unit[] = {
 	{ 2,	"inch" },
 	{ 3,	"cm" },
-	{-1, NULL},
 };
 
 
-static exif_description_t exif_ycbcr_positionig[] = {
+static const exif_description_t exif_ycbcr_positionig[] = {
 	{ 1,	"Centered" },
 	{ 2,	"Co-Sited" },
-	{-1, NULL}
 };
 
 
-static exif_description_t exif_exp_prog[] = {
+static const exif_description_t exif_exp_prog[] = {
 	{ 0,	"Not Defined" },
 	{ 1,	"Manual" },
 	{ 2,	"Normal" },
@@ -177,11 +176,10 @@ static exif_description_t exif_exp_prog[] = {
 	{ 6,	"Action" },
 	{ 7,	"Portrait Mode" },
 	{ 8,	"Landscape Mode" },
-	{-1, NULL}
 };
 
 
-static exif_description_t exif_component_conf[] = {
+static const exif_description_t exif_component_conf[] = {
 	{ 0,	"None" },
 	{ 1,	"Y" },
 	{ 2,	"Cb" },
@@ -190,11 +188,10 @@ static exif_description_t exif_component_conf[] = {
 	{ 5,	"G" },
 	{ 6,	"B" },
 	{ 0x030201, "YCbCr" },
-	{-1, NULL}
 };
 
 
-static exif_description_t exif_meter_mode[] = {
+static const exif_description_t exif_meter_mode[] = {
 	{ 0,	"Unknown" },
 	{ 1,	"Average" },
 	{ 2,	"Center Weighted Average" },
@@ -203,11 +200,10 @@ static exif_description_t exif_meter_mode[] = {
 	{ 5,	"Pattern" },
 	{ 6,	"Partial" },
 	{ 255,	"Other" },
-	{-1, NULL}
 };
 
 
-static exif_description_t exif_light_source[] = {
+static const exif_description_t exif_light_source[] = {
 	{ 0,	"Unknown" },
 	{ 1,	"Daylight" },
 	{ 2,	"Fluorescent" },
@@ -229,12 +225,11 @@ static exif_description_t exif_light_source[] = {
 	{ 23,	"D50" },
 	{ 24,	"ISO Studio Tungsten" },
 	{ 255,	"Other" },
-	{-1, NULL}
 };
 
 
 /* Flash mode bit masks (*not* values) */
-static exif_description_t exif_flash[] = {
+static const exif_description_t exif_flash[] = {
 	{ 0x00,	"No" },
 	{ 0x01,	"Yes" },
 	{ 0x04, "Return Not Detected" },
@@ -244,20 +239,18 @@ static exif_description_t exif_flash[] = {
 	{ 0x18,	"Auto" },
 	{ 0x20,	"No Flash" },
 	{ 0x40,	"Red Eye Reduce" },
-	{-1, NULL}
 };
 
 
 /* Color spaces */
-static exif_description_t exif_color_space[] = {
+static const exif_description_t exif_color_space[] = {
 	{ 1,	"sRGB" },
 	{0xffff, "Uncalibrated" },
-	{-1, NULL}
 };
 
 
 /* Image sensor types */
-static exif_description_t exif_sensing_method[] = {
+static const exif_description_t exif_sensing_method[] = {
 	{ 1,	"Not Defined" },
 	{ 2,	"One-Chip Color Area" },
 	{ 3,	"Two-Chip Color Area" },
@@ -265,300 +258,289 @@ static exif_description_t exif_sensing_method[] = {
 	{ 5,	"Color Sequential Area" },
 	{ 7,	"Trilinear" },
 	{ 8,	"Color Sequential Linear" },
-	{-1, NULL}
 };
 
 
-static exif_description_t exif_file_source[] = {
+static const exif_description_t exif_file_source[] = {
 	{ 0,	"Other" },
 	{ 1,	"Scanner (Transparent)" },
 	{ 2,	"Scanner (Reflex)" },
 	{ 3,	"Digital Still Camera" },
-	{-1, NULL}
 };
 
 
-static exif_description_t exif_scene_type[] = {
+static const exif_description_t exif_scene_type[] = {
 	{ 1,	"Directly Photographed" },
-	{-1, NULL}
 };
 
 
-static exif_description_t exif_custom_rendered[] = {
+static const exif_description_t exif_custom_rendered[] = {
 	{ 0,	"Normal" },
 	{ 1,	"Custom" },
-	{-1, NULL}
 };
 
 
-static exif_description_t exif_exp_mode[] = {
+static const exif_description_t exif_exp_mode[] = {
 	{ 0,	"Auto" },
 	{ 1,	"Manual" },
 	{ 2,	"Auto Bracket" },
-	{-1, NULL}
 };
 
 
-static exif_description_t exif_white_balance[] = {
+static const exif_description_t exif_white_balance[] = {
 	{ 0,	"Auto" },
 	{ 1,	"Manual" },
-	{-1, NULL}
 };
 
 
-static exif_description_t exif_scene_capture[] = {
+static const exif_description_t exif_scene_capture[] = {
 	{ 0,	"Standard" },
 	{ 1,	"Landscape" },
 	{ 2,	"Portrait" },
 	{ 3,	"Night Scene" },
-	{-1, NULL}
 };
 
 
 /* Gain control levels. */
-static exif_description_t exif_gain_ctrl[] = {
+static const exif_description_t exif_gain_ctrl[] = {
 	{ 0,	"None" },
 	{ 1,	"Low Gain Up" },
 	{ 2,	"High Gain Up" },
 	{ 3,	"Low Gain Down" },
 	{ 4,	"High Gain Down" },
-	{-1, NULL}
 };
 
 
-static exif_description_t exif_process[] = {
+static const exif_description_t exif_process[] = {
 	{ 0,	"Normal" },
 	{ 1,	"Soft" },
 	{ 2,	"Hard" },
-	{-1, NULL}
 };
 
 
-static exif_description_t exif_saturation[] = {
+static const exif_description_t exif_saturation[] = {
 	{ 0,	"Normal" },
 	{ 1,	"Low" },
 	{ 2,	"High" },
-	{-1, NULL}
 };
 
 
-static exif_description_t exif_subject_dist[] = {
+static const exif_description_t exif_subject_dist[] = {
 	{ 0,	"Unknown" },
 	{ 1,	"Macro" },
 	{ 2,	"Close View" },
 	{ 3,	"Distant View" },
-	{-1, NULL}
 };
 
-static exif_description_t exif_compression[] = {
+static const exif_description_t exif_compression[] = {
 	{ 1,	"None" },
 	{ 3,	"CCITT Group 3" },
 	{ 4,	"CCITT Group 4" },
 	{ 5,	"LZW" },
 	{ 6,	"JPEG" },
-	{-1, NULL}
 };
 
-/* Bytes per component type */
-uint8 format_bytes[12] = { 1, 1, 2, 4, 8, 1, 1, 2, 4, 8, 4, 8 };
+#define EXIF_TABLE_SIZE(table) (int)(sizeof(table) / sizeof(table[0]))
+#define EXIF_DESCR(table, key) exif_descr(table, EXIF_TABLE_SIZE(table), key)
 
 
 /*
-  Gets a description string from a look-up table.
-  Tables must be NULL-terminated.
+  Gets a description string from a look-up table of 'count' entries.
+  Tables must be sorted by id, a lookup takes a few compares at most.
 */
-char* exif_descr(exif_description_t *descr, int key)
+const char* exif_descr(const exif_description_t *descr, int count, int32 key)
 {
-    for ( ; descr && descr->id >= 0; descr++)
-        if (descr->id == (uint16)key)
-            return descr->name;
+    int lo = 0, hi = count - 1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        if (descr[mid].id < key)
+            lo = mid + 1;
+        else if (descr[mid].id > key)
+            hi = mid - 1;
+        else
+            return descr[mid].name;
+    }
     return NULL;
 }
 
 
-float rat2float(void *data)
+/*
+  Gets a tag name, NULL for tags not worth showing.
+*/
+const char* exif_tag_descr(int tag)
+{
+    return EXIF_DESCR(exif_tag_name, tag);
+}
+
+
+static float rat2float(const char *data)
 {
-    float f = *(int32*)data;
-    if (f == 0)
+    const int32 *r = (const int32*)data;
+    if (r[0] == 0)
        return 0;
-    return f / *(int32*)(data+4);
+    return (float)r[0] / r[1];
+}
+
+
+/*
+  Gets a tag number by name, -1 if unknown.
+  Only used to display a tag, so a plain scan will do.
+*/
+int exif_tag_number(const char *name)
+{
+    int i;
+    for (i = 0; i < EXIF_TABLE_SIZE(exif_tag_name); i++)
+        if (strcmp(exif_tag_name[i].name, name) == 0)
+            return exif_tag_name[i].id;
+    return -1;
+}
+
+
+/*
+  Copies 'src' into 's', 'size' bytes at most including the NUL.
+*/
+static char* copy_str(char *s, size_t size, const char *src, size_t length)
+{
+    if (length >= size)
+        length = size - 1;
+    memcpy(s, src, length);
+    s[length] = 0;
+    return s;
+}
+
+
+/*
+  Formats an integer without going through printf.
+*/
+static char* format_int(char *s, size_t size, uint32 value, int negative)
+{
+    char digits[12];
+    char *p = digits + sizeof(digits);
+    do {
+        *--p = '0' + value % 10;
+        value /= 10;
+    } while (value);
+    if (negative)
+        *--p = '-';
+    return copy_str(s, size, p, digits + sizeof(digits) - p);
 }
 
 
 /*
   Get tag entry value as a string.
+  's' holds 'size' bytes, nothing is allocated.
 */
-char* exif_str(char *s, exif_tag_t *tag)
+char* exif_str(char *s, size_t size, const exif_tag_t *tag)
 {
-    char *val = NULL;
+    const char *val = NULL;
+    if (size < 2)
+        return NULL;
     switch (tag->number) {
         case EXIF_ORIENTATION:
-            val = exif_descr(exif_orientation, tag->value);
+            val = EXIF_DESCR(exif_orientation, tag->value);
             break;
         case EXIF_FLASH:
-            val = exif_descr(exif_flash, tag->value & 1);
+            val = EXIF_DESCR(exif_flash, tag->value & 1);
             break;
         case EXIF_RESOLUTION_UNIT:
         case EXIF_FOCAL_PLANE_RESOLUTION_UNIT:
-            val = exif_descr(exif_res_unit, tag->value);
+            val = EXIF_DESCR(exif_res_unit, tag->value);
             break;
         case EXIF_METERING_MODE:
-            val = exif_descr(exif_meter_mode, tag->value);
+            val = EXIF_DESCR(exif_meter_mode, tag->value);
             break;
         case EXIF_YCBCR_POSITIONING:
-            val = exif_descr(exif_ycbcr_positionig, tag->value);
+            val = EXIF_DESCR(exif_ycbcr_positionig, tag->value);
             break;
         case EXIF_PLANAR_CONFIGURATION:
-            val = exif_descr(exif_planar_conf, tag->value);
+            val = EXIF_DESCR(exif_planar_conf, tag->value);
             break;
         case EXIF_COMPONENTS_CONFIGURATION:
-            val = exif_descr(exif_component_conf, tag->value);
+            val = EXIF_DESCR(exif_component_conf, tag->value);
             break;
         case EXIF_LIGHT_SOURCE:
-            val = exif_descr(exif_light_source, tag->value);
+            val = EXIF_DESCR(exif_light_source, tag->value);
             break;
         case EXIF_EXPOSURE_PROGRAM:
-            val = exif_descr(exif_exp_prog, tag->value);
+            val = EXIF_DESCR(exif_exp_prog, tag->value);
             break;
         case EXIF_COMPRESSION:
-            val = exif_descr(exif_compression, tag->value);
+            val = EXIF_DESCR(exif_compression, tag->value);
             break;
         case EXIF_COLOR_SPACE:
-            val = exif_descr(exif_color_space, tag->value);
+            val = EXIF_DESCR(exif_color_space, tag->value);
             break;
         case EXIF_SCENE_TYPE:
-            val = exif_descr(exif_scene_type, tag->value);
+            val = EXIF_DESCR(exif_scene_type, tag->value);
             break;
         case EXIF_EXIF_VERSION:
         case EXIF_FLASH_PIX_VERSION:
-            sprintf(s, "%c%c.%c%c", (char)(tag->value>>24), (char)(0xff&tag->value>>16), (char)(0xff&tag->value>>8), (char)(0xff&tag->value));
-            return s;
+        {
+            /* four characters, first byte lowest */
+            char version[5];
+            version[0] = (char)(0xff&tag->value);
+            version[1] = (char)(0xff&tag->value>>8);
+            version[2] = '.';
+            version[3] = (char)(0xff&tag->value>>16);
+            version[4] = (char)(tag->value>>24);
+            return copy_str(s, size, version, sizeof(version));
+        }
         case EXIF_FILE_SOURCE:
-            val = exif_descr(exif_file_source, tag->value);
+            val = EXIF_DESCR(exif_file_source, tag->value);
             break;
         case EXIF_SENSING_METHOD:
-            val = exif_descr(exif_sensing_method, tag->value);
+            val = EXIF_DESCR(exif_sensing_method, tag->value);
             break;
         case EXIF_WHITE_BALANCE:
-            val = exif_descr(exif_white_balance, tag->value);
+            val = EXIF_DESCR(exif_white_balance, tag->value);
             break;
         case EXIF_CUSTOM_RENDERED:
-            val = exif_descr(exif_custom_rendered, tag->value);
+            val = EXIF_DESCR(exif_custom_rendered, tag->value);
             break;
         case EXIF_EXPOSURE_MODE:
-            val = exif_descr(exif_exp_mode, tag->value);
+            val = EXIF_DESCR(exif_exp_mode, tag->value);
             break;
         case EXIF_SCENE_CAPTURE_TYPE:
-            val = exif_descr(exif_scene_capture, tag->value);
+            val = EXIF_DESCR(exif_scene_capture, tag->value);
             break;
         case EXIF_GAIN_CONTROL:
-            val = exif_descr(exif_gain_ctrl, tag->value);
+            val = EXIF_DESCR(exif_gain_ctrl, tag->value);
             break;
         case EXIF_SATURATION:
-            val = exif_descr(exif_saturation, tag->value);
+            val = EXIF_DESCR(exif_saturation, tag->value);
             break;
         case EXIF_SHARPNESS:
         case EXIF_CONTRAST:
-            val = exif_descr(exif_process, tag->value);
+            val = EXIF_DESCR(exif_process, tag->value);
             break;
         case EXIF_SUBJECT_DISTANCE_RANGE:
-            val = exif_descr(exif_subject_dist, tag->value);
+            val = EXIF_DESCR(exif_subject_dist, tag->value);
             break;
         default:
-            if (tag->format == FORMAT_STRING && tag->data)
-               strncpy(s, tag->data, tag->size);
-            else if (tag->format == FORMAT_URATIONAL || tag->format == FORMAT_SRATIONAL)
-                sprintf(s, "%g", rat2float(tag->data));
-            else if (tag->format == FORMAT_ULONG || tag->format == FORMAT_SLONG)
-                sprintf(s, "%ld", tag->value);
-            else if (tag->format == FORMAT_USHORT || tag->format == FORMAT_SSHORT)
-                sprintf(s, "%hd", (uint16)tag->value);
-            else
-                return NULL;
-            // got something
-            return s;
-    }
-    if (val)
-        strcpy(s, val);
-    return val;
-}
-
-
-/**
-    Scans EXIF IFD bytes.
-    If successful, returns an offset to the first tag.
-    'ofs' must point to a IFD start.
-    'data' must point to TIFF header start
-*/
-int read_ifd(exif_ifd_t* ifd, void *data, int ofs)
-{
-    // Sub-IFD offset will be found later with tags.
-    ifd->sub = 0;
-	ifd->next = 0;
-    if (ofs < 8 || ofs > 0xffff )
-        return 0;
-    ifd->ofs = ofs;
-    // TIFF header starts with byte ordering type.
-    ifd->align = *(char*)data;
-    if (ifd->align != 'M' && ifd->align != 'I')
-        return 0;
-    // IFD start - number of entries
-    ifd->size = *(int16*)(data + ofs);
-    if (ifd->align == 'M')
-       ifd->size = ntohs(ifd->size);
-    if (ifd->size < 1)
-        return 0;
-    // Next IFD offset is right after tag records.
-    ifd->next = *(uint32*)(data + ofs + 2 + ifd->size * 12);
-    if (ifd->align == 'M')
-       ifd->next = ntohl(ifd->next);
-    if (ifd->next > 0xffff || ifd->next < ofs)
-    	ifd->next = 0;
-    ofs += 2;
-    // should point to the first tag
-    return ofs;
-}
-
-
-/**
-    Scans EXIF tag bytes.
-    'ofs' must point to a tag start.
-*/
-int read_ifd_tag(exif_ifd_t* ifd, exif_tag_t *tag, void *data, int ofs)
-{
-    tag->number = *(uint16*)(data + ofs);
-    tag->format = *(uint16*)(data + ofs + 2);
-    tag->components = *(uint32*)(data + ofs + 4);
-    tag->value = *(uint32*)(data + ofs + 8);
-    tag->data = NULL;
-    if (ifd->align == 'M') {
-        // Big-endian ordering.
-        tag->number = ntohs(tag->number);
-        tag->format = ntohs(tag->format);
-        tag->components = ntohl(tag->components);
-        if (tag->format == FORMAT_USHORT || tag->format == FORMAT_SSHORT)
-            tag->value = ntohs(tag->value);
-        else if (tag->format != FORMAT_BYTE )
-            tag->value = ntohl(tag->value);
-    }
-    tag->size = tag->components * format_bytes[tag->format - 1];
-    //printf("* TAG %X: %d, %d\n", tag->number, tag->format, tag->size);
-    if (tag->number == EXIF_IFD_POINTER)
-        ifd->sub = tag->value;
-    else if (tag->size > 4) 
-    {
-        // out-of-place values
-        tag->data = data + tag->value;
-        if (ifd->align == 'M' && (tag->format == FORMAT_SRATIONAL || tag->format == FORMAT_URATIONAL)) {
-            *(int32*)(tag->data) = ntohl(*(int32*)(tag->data));
-            *(int32*)(tag->data + 4) = ntohl(*(int32*)(tag->data + 4));
-        }
-    }
-    else if (tag->format == FORMAT_STRING) {
-    	// a short string
-    	tag->data = data + ofs + 8;
+            switch (tag->format) {
+                case FORMAT_STRING:
+                    if (!tag->data)
+                        return NULL;
+                    return copy_str(s, size, tag->data, strnlen(tag->data, tag->size));
+                case FORMAT_URATIONAL:
+                case FORMAT_SRATIONAL:
+                    snprintf(s, size, "%g", rat2float(tag->data));
+                    return s;
+                case FORMAT_ULONG:
+                    return format_int(s, size, tag->value, 0);
+                case FORMAT_SLONG:
+                    return format_int(s, size, (int32)tag->value < 0 ? -(uint32)tag->value : tag->value,
+                        (int32)tag->value < 0);
+                case FORMAT_USHORT:
+                    return format_int(s, size, (uint16)tag->value, 0);
+                case FORMAT_SSHORT:
+                    return format_int(s, size, (int16)tag->value < 0 ? -(int16)tag->value : (uint16)tag->value,
+                        (int16)tag->value < 0);
+                default:
+                    return NULL;
+            }
     }
-    ofs += 12;
-    // should point to the next tag
-    return ofs;
+    if (!val)
+        return NULL;
+    return copy_str(s, size, val, strlen(val));
 }
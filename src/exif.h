@@ -32,6 +32,8 @@ SOFTWARE.
 #define __BEOS__
 #endif
 
+#include <stddef.h>
+
 /* Integer type casting */
 #ifndef __BEOS__
 
@@ -195,8 +197,8 @@ extern "C" {
 
 /* Tag data structures */
 typedef struct {
-        int id;
-        char *name;
+        int32 id;
+        const char *name;
 } exif_description_t;
 
 
@@ -210,25 +212,11 @@ typedef struct {
 } exif_tag_t;
 
 
-typedef struct {
-        void *data;
-        uint32 ofs;
-        uint32 next;
-        uint32 sub;
-        int16 size;
-        char align;
-} exif_ifd_t;
-
-
-/* Look-up tables */
-extern exif_description_t exif_tag_name[];
-
-
 /* Function prototypes */
-char* exif_descr(exif_description_t *descr, int key);
-char* exif_str(char *s, exif_tag_t *tag);
-int read_ifd(exif_ifd_t* ifd, void *data, int ofs);
-int read_ifd_tag(exif_ifd_t* ifd, exif_tag_t *tag, void *data, int ofs);
+const char* exif_descr(const exif_description_t *descr, int count, int32 key);
+const char* exif_tag_descr(int tag);
+int exif_tag_number(const char *name);
+char* exif_str(char *s, size_t size, const exif_tag_t *tag);
 
 
 #ifdef __cplusplus
@@ -12,7 +12,7 @@
 #define S_MARK_SUB NULL
 #define S_MARK_TIP _("Mark selected items.")
 #define S_PROGRESS_TIP _("Total item count")
-#define S_ZOOM_TIP _("Scale down.")
+#define S_ZOOM_TIP _("Scale the thumbnails.")
 #define S_TAGS_TIP ""
 #define S_ATTRS_TIP _("File attributes, drag tags here,  ENTER to edit.")
 #define S_RENAME_TIP _("Leave '*' in the filename to renumber multiple items.")
@@ -20,3 +20,6 @@
 #define S_THUMBNAIL_NAME_TIP _("These file attributes are always checked first for image previews.")
 #define S_FLICKER_TIP _("Use extra memory for a steadier display when scrolling etc.")
 #define S_RELOAD_TIP _("Reload existing items.")
+#define S_WORKERS_TIP _("Number of images decoded at the same time.")
+#define S_WATCHDIRS_TIP _("Track folders instead of every file, for very large collections.")
+#define S_WRITETHUMBS_TIP _("Save new thumbnails to the first thumbnail attribute, so they need not be made again.")
@@ -0,0 +1,223 @@
+/**
+\file HashTable.h
+\brief Open-addressing hash table of pointers
+*/
+
+#ifndef _HASHTABLE_H_
+#define _HASHTABLE_H_
+
+#include <SupportDefs.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+	A hash table of T pointers with linear probing.
+	Removal shifts the following entries back, so there are no tombstones
+	and lookups stay short no matter how much the table has churned.
+
+	The Definition class tells how items are keyed:
+		typedef ... KeyType;
+		static const KeyType& Key(const T *item);
+		static uint32 Hash(const KeyType &key);
+	and KeyType must have an operator==.
+
+	An owning table deletes its items in MakeEmpty() and when it is
+	destroyed. Remove() and RemoveItem() never delete, the caller owns
+	what it takes out.
+*/
+template <class T, class Definition>
+class HashTable {
+	public:
+
+	typedef typename Definition::KeyType KeyType;
+
+	HashTable(bool owning = false, int32 capacity = 64):
+		fTable(NULL),
+		fCapacity(0),
+		fCount(0),
+		fOwning(owning)
+	{
+		Resize(capacity);
+	}
+
+	~HashTable()
+	{
+		MakeEmpty();
+		free(fTable);
+	}
+
+	inline int32 CountItems() const
+	{
+		return fCount;
+	}
+
+	/// Number of slots, for iterating with SlotAt().
+	inline int32 Capacity() const
+	{
+		return fCapacity;
+	}
+
+	/// Item in a slot, or NULL if the slot is free.
+	inline T* SlotAt(int32 slot) const
+	{
+		return fTable[slot];
+	}
+
+	T* Lookup(const KeyType &key) const
+	{
+		uint32 mask = fCapacity - 1;
+		for (uint32 i = Definition::Hash(key) & mask; fTable[i]; i = (i + 1) & mask)
+			if (Definition::Key(fTable[i]) == key)
+				return fTable[i];
+		return NULL;
+	}
+
+	/**
+		Adds an item, unless an item with the same key exists.
+	*/
+	bool Insert(T *item)
+	{
+		if ((fCount + 1) * 2 > fCapacity && !Resize(fCapacity * 2))
+			return false;
+		uint32 mask = fCapacity - 1;
+		const KeyType &key = Definition::Key(item);
+		uint32 i = Definition::Hash(key) & mask;
+		for (; fTable[i]; i = (i + 1) & mask)
+			if (Definition::Key(fTable[i]) == key)
+				return false;
+		fTable[i] = item;
+		fCount++;
+		return true;
+	}
+
+	/**
+		Takes the item with 'key' out of the table and returns it.
+		It is returned even when owned, the caller deletes it then.
+	*/
+	T* Remove(const KeyType &key)
+	{
+		uint32 mask = fCapacity - 1;
+		for (uint32 i = Definition::Hash(key) & mask; fTable[i]; i = (i + 1) & mask)
+			if (Definition::Key(fTable[i]) == key) {
+				T *item = fTable[i];
+				RemoveSlot(i);
+				return item;
+			}
+		return NULL;
+	}
+
+	/**
+		Takes out exactly 'item'.
+	*/
+	bool RemoveItem(T *item)
+	{
+		uint32 mask = fCapacity - 1;
+		for (uint32 i = Definition::Hash(Definition::Key(item)) & mask; fTable[i]; i = (i + 1) & mask)
+			if (fTable[i] == item) {
+				RemoveSlot(i);
+				return true;
+			}
+		return false;
+	}
+
+	void MakeEmpty()
+	{
+		for (int32 i = 0; i < fCapacity; i++) {
+			if (fOwning)
+				delete fTable[i];
+			fTable[i] = NULL;
+		}
+		fCount = 0;
+	}
+
+	private:
+
+	/**
+		Frees a slot and moves back whatever probed past it.
+	*/
+	void RemoveSlot(uint32 hole)
+	{
+		uint32 mask = fCapacity - 1;
+		fTable[hole] = NULL;
+		fCount--;
+		for (uint32 i = (hole + 1) & mask; fTable[i]; i = (i + 1) & mask) {
+			uint32 home = Definition::Hash(Definition::Key(fTable[i])) & mask;
+			// Can it be reached from its home slot without the hole?
+			if (((i - home) & mask) >= ((i - hole) & mask)) {
+				fTable[hole] = fTable[i];
+				fTable[i] = NULL;
+				hole = i;
+			}
+		}
+	}
+
+	/**
+		Rehashes into 'capacity' slots, rounded up to a power of two.
+	*/
+	bool Resize(int32 capacity)
+	{
+		int32 size = 16;
+		while (size < capacity)
+			size <<= 1;
+		T **table = (T**)calloc(size, sizeof(T*));
+		if (!table)
+			return false;
+		T **old = fTable;
+		int32 oldCapacity = fCapacity;
+		fTable = table;
+		fCapacity = size;
+		uint32 mask = size - 1;
+		for (int32 i = 0; i < oldCapacity; i++) {
+			if (!old[i])
+				continue;
+			uint32 j = Definition::Hash(Definition::Key(old[i])) & mask;
+			while (fTable[j])
+				j = (j + 1) & mask;
+			fTable[j] = old[i];
+		}
+		free(old);
+		return true;
+	}
+
+	T **fTable;
+	int32 fCapacity;
+	int32 fCount;
+	bool fOwning;
+};
+
+
+/**
+	Mixes a 64-bit value into a well spread 32-bit hash.
+*/
+inline uint32 hash_int64(uint64 value)
+{
+	value ^= value >> 33;
+	value *= 0xff51afd7ed558ccdULL;
+	value ^= value >> 33;
+	return (uint32)value;
+}
+
+
+/**
+	FNV-1a string hash.
+*/
+inline uint32 hash_string(const char *string, uint32 hash = 2166136261U)
+{
+	if (string)
+		while (*string)
+			hash = (hash ^ (uint8)*string++) * 16777619;
+	return hash;
+}
+
+/**
+	FNV-1a hash of a block of memory.
+*/
+inline uint32 hash_data(const void *data, size_t size, uint32 hash = 2166136261U)
+{
+	const uint8 *bytes = (const uint8*)data;
+	for (size_t i = 0; i < size; i++)
+		hash = (hash ^ bytes[i]) * 16777619;
+	return hash;
+}
+
+#endif	// _HASHTABLE_H_
@@ -0,0 +1,71 @@
+/**
+\file ImageScaler.cpp
+\brief BBitmap front end of PixelScaler
+*/
+
+#include <Bitmap.h>
+#include <InterfaceDefs.h>
+#include "ImageScaler.h"
+#include "PixelScaler.h"
+
+
+/// The PixelScaler format of a color space, NONE if there is none.
+static PixelScaler::format pixel_format(color_space space)
+{
+	switch (space) {
+		case B_RGB32:
+			return PixelScaler::RGB32;
+		case B_RGBA32:
+			return PixelScaler::RGBA32;
+		case B_RGB24:
+			return PixelScaler::RGB24;
+		case B_GRAY8:
+			return PixelScaler::GRAY8;
+		case B_CMAP8:
+			return PixelScaler::CMAP8;
+		default:
+			return PixelScaler::NONE;
+	}
+}
+
+
+/**
+	Returns the color space Scale() produces for 'srcSpace',
+	B_RGBA32 if the source can be transparent, B_RGB32 otherwise.
+	B_NO_COLOR_SPACE means the source is not supported.
+*/
+color_space ImageScaler::OutputSpace(color_space srcSpace)
+{
+	switch (PixelScaler::OutputFormat(pixel_format(srcSpace))) {
+		case PixelScaler::RGBA32:
+			return B_RGBA32;
+		case PixelScaler::RGB32:
+			return B_RGB32;
+		default:
+			return B_NO_COLOR_SPACE;
+	}
+}
+
+
+/**
+	Returns a new bitmap of 'width' x 'height' pixels, or NULL if
+	the source color space is not supported.
+*/
+BBitmap* ImageScaler::Scale(const BBitmap *source, int32 width, int32 height)
+{
+	color_space space = source->ColorSpace();
+	if (OutputSpace(space) == B_NO_COLOR_SPACE)
+		return NULL;
+	// rgb_color is laid out as the R, G, B, A entries PixelScaler takes
+	const uint8 *palette = space == B_CMAP8 ? (const uint8*)system_colors()->color_list : NULL;
+	BBitmap *bitmap = new BBitmap(BRect(0, 0, width - 1, height - 1), OutputSpace(space));
+	BRect bounds = source->Bounds();
+	if (bitmap->InitCheck() != B_OK
+		|| !PixelScaler::Scale((const uint8*)source->Bits(), bounds.IntegerWidth() + 1, bounds.IntegerHeight() + 1,
+			source->BytesPerRow(), pixel_format(space), (uint8*)bitmap->Bits(), width, height,
+			bitmap->BytesPerRow(), palette)) {
+		delete bitmap;
+		return NULL;
+	}
+	return bitmap;
+}
@@ -0,0 +1,25 @@
+/**
+\file ImageScaler.h
+\brief Area-averaging bitmap scaler
+*/
+
+#ifndef _IMAGESCALER_H_
+#define _IMAGESCALER_H_
+
+#include <GraphicsDefs.h>
+
+class BBitmap;
+
+/**
+	Scales BBitmaps on the CPU, with PixelScaler.
+	No app_server round trip is involved.
+*/
+class ImageScaler
+{
+	public:
+
+	static BBitmap* Scale(const BBitmap *source, int32 width, int32 height);
+	static color_space OutputSpace(color_space srcSpace);
+};
+
+#endif
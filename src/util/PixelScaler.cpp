@@ -0,0 +1,252 @@
+/**
+\file PixelScaler.cpp
+\brief Area-averaging pixel buffer scaler
+
+The scaler works in two separable passes. Source rows are converted to
+four floats per pixel (B, G, R, A) and summed into an accumulator row
+with their vertical coverage as weight, then every destination pixel
+sums the accumulator columns it covers with their horizontal coverage.
+Pixels with alpha are premultiplied first, so transparent areas do not
+bleed their color into the edges.
+
+Pixels are GCC vector types where available, so each multiply-add is a
+single SIMD instruction on x86 (SSE) and ARM (NEON) alike, with plain
+structs for older compilers.
+
+Nothing here depends on Haiku, tests/ builds and benchmarks it on any
+system with a C++ compiler.
+*/
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "PixelScaler.h"
+
+#if defined(__GNUC__) && __GNUC__ >= 4
+typedef float pixel_t __attribute__((vector_size(16)));
+
+static inline pixel_t make_pixel(float b, float g, float r, float a)
+{
+	pixel_t p = { b, g, r, a };
+	return p;
+}
+#else
+struct pixel_t {
+	float v[4];
+	inline pixel_t& operator+=(const pixel_t &p)
+	{
+		v[0] += p.v[0]; v[1] += p.v[1]; v[2] += p.v[2]; v[3] += p.v[3];
+		return *this;
+	}
+	inline pixel_t operator*(const pixel_t &p) const
+	{
+		pixel_t r = {{ v[0]*p.v[0], v[1]*p.v[1], v[2]*p.v[2], v[3]*p.v[3] }};
+		return r;
+	}
+};
+
+static inline pixel_t make_pixel(float b, float g, float r, float a)
+{
+	pixel_t p = {{ b, g, r, a }};
+	return p;
+}
+#endif
+
+static inline pixel_t splat(float f)
+{
+	return make_pixel(f, f, f, f);
+}
+
+
+/// Source pixels covered by one destination pixel
+struct span {
+	int32_t first;
+	int32_t count;
+	// offset into the weight table
+	int32_t weights;
+};
+
+
+/**
+	Works out which source pixels each destination pixel covers, and
+	how much of each. Weights of a span add up to 1.
+*/
+static void make_spans(int32_t srcSize, int32_t dstSize, span *spans, float *weights)
+{
+	float scale = (float)srcSize / dstSize;
+	int32_t w = 0;
+	for (int32_t i = 0; i < dstSize; i++) {
+		float x0 = i * scale;
+		float x1 = (i + 1) * scale;
+		int32_t first = (int32_t)x0;
+		int32_t last = (int32_t)ceilf(x1);
+		if (last > srcSize)
+			last = srcSize;
+		if (last <= first)
+			last = first + 1;
+		spans[i].first = first;
+		spans[i].count = last - first;
+		spans[i].weights = w;
+		float sum = 0;
+		for (int32_t j = first; j < last; j++) {
+			float a = (j + 1 < x1 ? j + 1 : x1) - (j > x0 ? j : x0);
+			if (a < 0)
+				a = 0;
+			weights[w++] = a;
+			sum += a;
+		}
+		for (int32_t j = spans[i].weights; j < w; j++)
+			weights[j] = sum > 0 ? weights[j] / sum : 1.0f / spans[i].count;
+	}
+}
+
+
+/**
+	Converts a row of source pixels, premultiplying alpha.
+*/
+static void load_row(const uint8_t *src, int32_t width, PixelScaler::format space, const uint8_t *palette, pixel_t *out)
+{
+	switch (space) {
+		case PixelScaler::RGB32:
+			for (int32_t x = 0; x < width; x++, src += 4)
+				out[x] = make_pixel(src[0], src[1], src[2], 255);
+			break;
+		case PixelScaler::RGBA32:
+			for (int32_t x = 0; x < width; x++, src += 4) {
+				float a = src[3] / 255.0f;
+				out[x] = make_pixel(src[0] * a, src[1] * a, src[2] * a, src[3]);
+			}
+			break;
+		case PixelScaler::RGB24:
+			for (int32_t x = 0; x < width; x++, src += 3)
+				out[x] = make_pixel(src[0], src[1], src[2], 255);
+			break;
+		case PixelScaler::GRAY8:
+			for (int32_t x = 0; x < width; x++, src++)
+				out[x] = make_pixel(src[0], src[0], src[0], 255);
+			break;
+		case PixelScaler::CMAP8:
+			for (int32_t x = 0; x < width; x++, src++) {
+				if (*src == PIXELSCALER_TRANSPARENT_CMAP8) {
+					out[x] = splat(0);
+					continue;
+				}
+				const uint8_t *c = palette + 4 * *src;
+				out[x] = make_pixel(c[2], c[1], c[0], 255);
+			}
+			break;
+		default:
+			break;
+	}
+}
+
+
+static inline uint8_t clamp_byte(float v)
+{
+	if (v <= 0)
+		return 0;
+	if (v >= 255)
+		return 255;
+	return (uint8_t)(v + 0.5f);
+}
+
+
+/**
+	Returns the format Scale() produces for 'srcFormat',
+	RGBA32 if the source can be transparent, RGB32 otherwise.
+	NONE means the source is not supported.
+*/
+PixelScaler::format PixelScaler::OutputFormat(format srcFormat)
+{
+	switch (srcFormat) {
+		case RGBA32:
+		case CMAP8:
+			return RGBA32;
+		case RGB32:
+		case RGB24:
+		case GRAY8:
+			return RGB32;
+		default:
+			return NONE;
+	}
+}
+
+
+/**
+	Scales 'src' to exactly 'dstWidth' x 'dstHeight' pixels into 'dst',
+	in the format given by OutputFormat().
+	'palette' is required for CMAP8.
+	Returns false if the input is not supported or memory ran out.
+*/
+bool PixelScaler::Scale(const uint8_t *src, int32_t srcWidth, int32_t srcHeight, int32_t srcBytesPerRow,
+	format srcFormat, uint8_t *dst, int32_t dstWidth, int32_t dstHeight, int32_t dstBytesPerRow,
+	const uint8_t *palette)
+{
+	format dstFormat = OutputFormat(srcFormat);
+	if (dstFormat == NONE || (srcFormat == CMAP8 && !palette))
+		return false;
+	if (srcWidth <= 0 || srcHeight <= 0 || dstWidth <= 0 || dstHeight <= 0)
+		return false;
+
+	span *xspans = new span[dstWidth];
+	span *yspans = new span[dstHeight];
+	float *xweights = new float[srcWidth + 2*dstWidth];
+	float *yweights = new float[srcHeight + 2*dstHeight];
+	pixel_t *row = (pixel_t*)malloc(srcWidth * sizeof(pixel_t));
+	pixel_t *acc = (pixel_t*)malloc(srcWidth * sizeof(pixel_t));
+	if (!row || !acc) {
+		free(row);
+		free(acc);
+		delete[] xspans;
+		delete[] yspans;
+		delete[] xweights;
+		delete[] yweights;
+		return false;
+	}
+	make_spans(srcWidth, dstWidth, xspans, xweights);
+	make_spans(srcHeight, dstHeight, yspans, yweights);
+	bool alpha = dstFormat == RGBA32;
+
+	for (int32_t y = 0; y < dstHeight; y++) {
+		// vertical pass
+		const span &ys = yspans[y];
+		for (int32_t x = 0; x < srcWidth; x++)
+			acc[x] = splat(0);
+		for (int32_t j = 0; j < ys.count; j++) {
+			load_row(src + (ys.first + j) * srcBytesPerRow, srcWidth, srcFormat, palette, row);
+			pixel_t w = splat(yweights[ys.weights + j]);
+			for (int32_t x = 0; x < srcWidth; x++)
+				acc[x] += row[x] * w;
+		}
+
+		// horizontal pass
+		uint8_t *out = dst + y * dstBytesPerRow;
+		for (int32_t x = 0; x < dstWidth; x++, out += 4) {
+			const span &xs = xspans[x];
+			const float *weights = xweights + xs.weights;
+			pixel_t sum = splat(0);
+			for (int32_t i = 0; i < xs.count; i++)
+				sum += acc[xs.first + i] * splat(weights[i]);
+			float p[4];
+			memcpy(p, &sum, sizeof(p));
+			if (alpha && p[3] > 0 && p[3] < 255) {
+				float k = 255 / p[3];
+				p[0] *= k;
+				p[1] *= k;
+				p[2] *= k;
+			}
+			out[0] = clamp_byte(p[0]);
+			out[1] = clamp_byte(p[1]);
+			out[2] = clamp_byte(p[2]);
+			out[3] = alpha ? clamp_byte(p[3]) : 255;
+		}
+	}
+
+	free(row);
+	free(acc);
+	delete[] xspans;
+	delete[] yspans;
+	delete[] xweights;
+	delete[] yweights;
+	return true;
+}
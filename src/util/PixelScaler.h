@@ -0,0 +1,46 @@
+/**
+\file PixelScaler.h
+\brief Area-averaging pixel buffer scaler
+*/
+
+#ifndef _PIXELSCALER_H_
+#define _PIXELSCALER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+	Scales pixel buffers on the CPU.
+	Every destination pixel is the exact area-weighted average of the
+	source pixels under it, which stays sharp and alias-free at any
+	reduction ratio. Needs nothing but the C library, so it builds and
+	runs anywhere, ImageScaler wraps it for BBitmaps.
+*/
+class PixelScaler
+{
+	public:
+
+	/// Buffer layouts, the same byte order as the Haiku color spaces
+	enum format {
+		NONE = 0,
+		// B, G, R, unused
+		RGB32,
+		// B, G, R, A
+		RGBA32,
+		// B, G, R
+		RGB24,
+		GRAY8,
+		// indices into a palette of 256 R, G, B, A entries
+		CMAP8
+	};
+
+	static bool Scale(const uint8_t *src, int32_t srcWidth, int32_t srcHeight, int32_t srcBytesPerRow,
+		format srcFormat, uint8_t *dst, int32_t dstWidth, int32_t dstHeight, int32_t dstBytesPerRow,
+		const uint8_t *palette = NULL);
+	static format OutputFormat(format srcFormat);
+};
+
+// CMAP8 index of transparent pixels
+#define PIXELSCALER_TRANSPARENT_CMAP8 0xff
+
+#endif
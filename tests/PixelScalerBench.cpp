@@ -0,0 +1,64 @@
+/**
+\file PixelScalerBench.cpp
+\brief Times PixelScaler on typical thumbnail jobs
+
+Plain C++, runs on any system: make -C tests bench
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include "PixelScaler.h"
+
+
+static double now()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+
+/**
+	Scales a noise image of 'srcWidth' x 'srcHeight' to 'dstWidth' x
+	'dstHeight' until a second has passed, and prints the time per call.
+*/
+static void bench(const char *name, PixelScaler::format format, int bytes,
+	int32_t srcWidth, int32_t srcHeight, int32_t dstWidth, int32_t dstHeight)
+{
+	int32_t srcBpr = srcWidth * bytes;
+	uint8_t *src = (uint8_t*)malloc(srcBpr * srcHeight);
+	uint8_t *dst = (uint8_t*)malloc(dstWidth * 4 * dstHeight);
+	srand(1);
+	for (int32_t i = 0; i < srcBpr * srcHeight; i++)
+		src[i] = rand();
+
+	int runs = 0;
+	double start = now(), elapsed;
+	do {
+		PixelScaler::Scale(src, srcWidth, srcHeight, srcBpr, format,
+			dst, dstWidth, dstHeight, dstWidth * 4);
+		runs++;
+		elapsed = now() - start;
+	} while (elapsed < 1.0);
+	printf("%-8s %5dx%-5d -> %4dx%-4d %9.3f ms  %7.1f Mpixel/s\n", name,
+		(int)srcWidth, (int)srcHeight, (int)dstWidth, (int)dstHeight,
+		elapsed * 1000 / runs, (double)srcWidth * srcHeight * runs / elapsed / 1e6);
+	free(src);
+	free(dst);
+}
+
+
+int main()
+{
+	// a camera JPEG decoded at 1/8, and full size
+	bench("RGB32", PixelScaler::RGB32, 4, 500, 375, 160, 120);
+	bench("RGB32", PixelScaler::RGB32, 4, 4000, 3000, 160, 120);
+	bench("RGBA32", PixelScaler::RGBA32, 4, 1024, 768, 160, 120);
+	bench("RGB24", PixelScaler::RGB24, 3, 1024, 768, 160, 120);
+	bench("GRAY8", PixelScaler::GRAY8, 1, 1024, 768, 160, 120);
+	// odd ratios and zooming in
+	bench("RGB32", PixelScaler::RGB32, 4, 1001, 997, 240, 239);
+	bench("RGB32", PixelScaler::RGB32, 4, 160, 120, 640, 480);
+	return 0;
+}
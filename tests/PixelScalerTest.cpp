@@ -0,0 +1,201 @@
+/**
+\file PixelScalerTest.cpp
+\brief Checks PixelScaler against hand-computed area averages
+
+Plain C++, runs on any system: make -C tests test
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "PixelScaler.h"
+
+static int sFailures = 0;
+
+#define CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+			sFailures++; \
+		} \
+	} while (0)
+
+/// Output bytes may be off by one from the exact average, for rounding.
+static bool near(int value, int expected)
+{
+	return abs(value - expected) <= 1;
+}
+
+
+static bool pixel_is(const uint8_t *p, int b, int g, int r, int a)
+{
+	bool ok = near(p[0], b) && near(p[1], g) && near(p[2], r) && near(p[3], a);
+	if (!ok)
+		fprintf(stderr, "  got %d %d %d %d, expected %d %d %d %d\n", p[0], p[1], p[2], p[3], b, g, r, a);
+	return ok;
+}
+
+
+/// 4x4 to 2x2 is the plain average of each 2x2 block.
+static void test_rgb32_blocks()
+{
+	uint8_t src[4 * 4 * 4];
+	for (int y = 0; y < 4; y++) {
+		for (int x = 0; x < 4; x++) {
+			uint8_t *p = src + (y * 4 + x) * 4;
+			p[0] = x * 40;
+			p[1] = y * 40;
+			p[2] = (x + y) * 20;
+			p[3] = 0;
+		}
+	}
+	uint8_t dst[2 * 2 * 4];
+	CHECK(PixelScaler::Scale(src, 4, 4, 16, PixelScaler::RGB32, dst, 2, 2, 8));
+	// blue averages x 0,1 -> 20 and 2,3 -> 100, green likewise with y
+	CHECK(pixel_is(dst + 0, 20, 20, 20, 255));
+	CHECK(pixel_is(dst + 4, 100, 20, 60, 255));
+	CHECK(pixel_is(dst + 8, 20, 100, 60, 255));
+	CHECK(pixel_is(dst + 12, 100, 100, 100, 255));
+}
+
+
+/// Transparent pixels do not darken the opaque ones they are mixed with.
+static void test_rgba32_premultiplied()
+{
+	uint8_t src[2 * 2 * 4] = {
+		0, 0, 255, 255,		0, 0, 0, 0,
+		0, 0, 0, 0,			0, 0, 255, 255
+	};
+	uint8_t dst[4];
+	CHECK(PixelScaler::OutputFormat(PixelScaler::RGBA32) == PixelScaler::RGBA32);
+	CHECK(PixelScaler::Scale(src, 2, 2, 8, PixelScaler::RGBA32, dst, 1, 1, 4));
+	// half covered, fully red where it is
+	CHECK(pixel_is(dst, 0, 0, 255, 128));
+
+	// 3 of 4 opaque, with different colors
+	uint8_t src2[2 * 2 * 4] = {
+		200, 0, 0, 255,		0, 200, 0, 255,
+		0, 0, 200, 255,		90, 90, 90, 0
+	};
+	CHECK(PixelScaler::Scale(src2, 2, 2, 8, PixelScaler::RGBA32, dst, 1, 1, 4));
+	CHECK(pixel_is(dst, 67, 67, 67, 191));
+}
+
+
+/// Gray comes out as RGB32 with all channels equal.
+static void test_gray8()
+{
+	uint8_t src[3 * 2] = {
+		0, 30, 60,
+		90, 120, 150
+	};
+	uint8_t dst[4];
+	CHECK(PixelScaler::OutputFormat(PixelScaler::GRAY8) == PixelScaler::RGB32);
+	CHECK(PixelScaler::Scale(src, 3, 2, 3, PixelScaler::GRAY8, dst, 1, 1, 4));
+	CHECK(pixel_is(dst, 75, 75, 75, 255));
+}
+
+
+/// 1x1 stays, grows and shrinks into itself.
+static void test_single_pixel()
+{
+	uint8_t src[4] = { 10, 20, 30, 0 };
+	uint8_t dst[3 * 3 * 4];
+	CHECK(PixelScaler::Scale(src, 1, 1, 4, PixelScaler::RGB32, dst, 1, 1, 4));
+	CHECK(pixel_is(dst, 10, 20, 30, 255));
+	CHECK(PixelScaler::Scale(src, 1, 1, 4, PixelScaler::RGB32, dst, 3, 3, 12));
+	for (int i = 0; i < 9; i++)
+		CHECK(pixel_is(dst + 4 * i, 10, 20, 30, 255));
+
+	uint8_t gray[5 * 5];
+	for (int i = 0; i < 25; i++)
+		gray[i] = i * 10;
+	CHECK(PixelScaler::Scale(gray, 5, 5, 5, PixelScaler::GRAY8, dst, 1, 1, 4));
+	CHECK(pixel_is(dst, 120, 120, 120, 255));
+}
+
+
+/**
+	3 to 2 pixels: the first covers source pixels 0 and half of 1,
+	the second the other half of 1 and pixel 2.
+	(0 * 1 + 90 * 0.5) / 1.5 = 30, (90 * 0.5 + 180 * 1) / 1.5 = 150
+*/
+static void test_fractional_ratio()
+{
+	uint8_t src[3] = { 0, 90, 180 };
+	uint8_t dst[2 * 4];
+	CHECK(PixelScaler::Scale(src, 3, 1, 3, PixelScaler::GRAY8, dst, 2, 1, 8));
+	CHECK(pixel_is(dst, 30, 30, 30, 255));
+	CHECK(pixel_is(dst + 4, 150, 150, 150, 255));
+
+	// and vertically, 5 rows into 3: weights 3/5 and 2/5 at the seams
+	uint8_t column[5] = { 0, 50, 100, 150, 200 };
+	uint8_t out[3 * 4];
+	CHECK(PixelScaler::Scale(column, 1, 5, 1, PixelScaler::GRAY8, out, 1, 3, 4));
+	CHECK(pixel_is(out, 20, 20, 20, 255));
+	CHECK(pixel_is(out + 4, 100, 100, 100, 255));
+	CHECK(pixel_is(out + 8, 180, 180, 180, 255));
+}
+
+
+/// Row padding of either buffer is skipped.
+static void test_row_padding()
+{
+	uint8_t src[2 * 8];
+	memset(src, 0xee, sizeof(src));
+	src[0] = 10; src[1] = 30;
+	src[8] = 50; src[9] = 70;
+	uint8_t dst[2 * 16];
+	memset(dst, 0xee, sizeof(dst));
+	CHECK(PixelScaler::Scale(src, 2, 2, 8, PixelScaler::GRAY8, dst, 1, 2, 16));
+	CHECK(pixel_is(dst, 20, 20, 20, 255));
+	CHECK(pixel_is(dst + 16, 60, 60, 60, 255));
+	CHECK(dst[4] == 0xee);
+}
+
+
+/// Palette entries are R, G, B, A, the magic index is transparent.
+static void test_cmap8()
+{
+	uint8_t palette[256 * 4];
+	memset(palette, 0, sizeof(palette));
+	palette[4 * 1 + 0] = 255;
+	palette[4 * 2 + 2] = 255;
+	uint8_t src[2] = { 1, PIXELSCALER_TRANSPARENT_CMAP8 };
+	uint8_t dst[2 * 4];
+	CHECK(!PixelScaler::Scale(src, 2, 1, 2, PixelScaler::CMAP8, dst, 2, 1, 8));
+	CHECK(PixelScaler::Scale(src, 2, 1, 2, PixelScaler::CMAP8, dst, 2, 1, 8, palette));
+	CHECK(pixel_is(dst, 0, 0, 255, 255));
+	CHECK(dst[7] == 0);
+	CHECK(PixelScaler::Scale(src, 2, 1, 2, PixelScaler::CMAP8, dst, 1, 1, 4, palette));
+	CHECK(pixel_is(dst, 0, 0, 255, 128));
+}
+
+
+static void test_bad_input()
+{
+	uint8_t buf[16];
+	CHECK(!PixelScaler::Scale(buf, 0, 1, 4, PixelScaler::RGB32, buf, 1, 1, 4));
+	CHECK(!PixelScaler::Scale(buf, 1, 1, 4, PixelScaler::RGB32, buf, 1, 0, 4));
+	CHECK(!PixelScaler::Scale(buf, 1, 1, 4, PixelScaler::NONE, buf, 1, 1, 4));
+	CHECK(PixelScaler::OutputFormat(PixelScaler::NONE) == PixelScaler::NONE);
+}
+
+
+int main()
+{
+	test_rgb32_blocks();
+	test_rgba32_premultiplied();
+	test_gray8();
+	test_single_pixel();
+	test_fractional_ratio();
+	test_row_padding();
+	test_cmap8();
+	test_bad_input();
+	if (sFailures) {
+		fprintf(stderr, "%d checks failed\n", sFailures);
+		return 1;
+	}
+	printf("PixelScaler: all checks passed\n");
+	return 0;
+}